@@ -7,9 +7,22 @@
 
 typedef struct buf //协议栈的通用数据包buffer, 可以在头部装卸数据，以供协议头的添加和去除
 {
-    size_t len;                   // 包中有效数据大小
-    uint8_t *data;                // 包的数据起始地址
-    uint8_t payload[BUF_MAX_LEN]; // 最大负载数据量
+    size_t len;            // 包中有效数据大小
+    uint8_t *data;         // 包的数据起始地址
+    uint8_t *payload;      // 存储区起始地址，存储区按size class分配，未分配为NULL
+    size_t cap;            // 存储区容量，等于所属size class的大小
+    int ref;               // 引用计数，0为不属于缓冲池的buffer（静态区或栈上）
+    struct buf *pool_next; // 缓冲池空闲链表中的下一个buffer
+    struct buf *next;      // scatter-gather链中的下一段，链上各段归链头所有
+    struct buf *owner;     // 切片所引用数据的所属buffer，非切片为NULL
+    int external;          // 存储区在协议栈外部（如pcap的帧缓冲），只在本次处理期间有效
+    uint8_t *l2;           // 收到的包的以太网头，由ethernet_in记录，未解析为NULL
+    uint8_t *l3;           // 收到的包的网络层头（ip/arp），由ethernet_in记录
+    uint8_t *l4;           // 收到的包的传输层头，由ip_in记录
+    uint8_t src_ip[4];     // 收到的包的源ip地址，由ip_in记录
+    uint8_t dst_ip[4];     // 收到的包的目的ip地址，由ip_in记录
+    uint16_t src_port;     // 收到的包的源端口（主机序），由udp_in/tcp_in记录
+    uint16_t dst_port;     // 收到的包的目的端口（主机序），由udp_in/tcp_in记录
 } buf_t;
 
 int buf_init(buf_t *buf, size_t len);
@@ -17,6 +30,18 @@ int buf_add_header(buf_t *buf, size_t len);
 int buf_remove_header(buf_t *buf, size_t len);
 int buf_add_padding(buf_t *buf, size_t len);
 int buf_remove_padding(buf_t *buf, size_t len);
+int buf_reserve(buf_t *buf, size_t len);
 void buf_copy(void *pdst, const void *psrc, size_t len);
+int buf_move(buf_t *dst, buf_t *src);
+int buf_wrap(buf_t *buf, uint8_t *data, size_t len);
+buf_t *buf_alloc(size_t len);
+buf_t *buf_get(buf_t *buf);
+void buf_put(buf_t *buf);
+buf_t *buf_slice(buf_t *buf, size_t offset, size_t len);
+void buf_chain(buf_t *head, buf_t *tail);
+size_t buf_chain_len(const buf_t *buf);
+size_t buf_gather(const buf_t *buf, uint8_t *dst, size_t max_len);
+uint32_t buf_checksum16_partial(const buf_t *buf);
+uint16_t buf_checksum16(const buf_t *buf);
 
 #endif
\ No newline at end of file
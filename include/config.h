@@ -34,12 +34,36 @@
 
 #define ETHERNET_MAX_TRANSPORT_UNIT 1500 //以太网最大传输单元
 
+#define DRIVER_ZERO_COPY //接收时直接在pcap的帧缓冲上处理数据包，不拷贝到buf中
+
+// #define NET_CONCURRENT_TABLES //arp表和udp表允许多个线程无锁读取，写者互斥
+
 #define ARP_TIMEOUT_SEC (60 * 5) //arp表过期时间
 #define ARP_MIN_INTERVAL 1       //向相同地址发送arp请求的最小间隔
+#define ARP_MAX_ENTRY 1024       //arp表最大容量，满了淘汰最近没有用过的表项
+#define ARP_MAX_PENDING 256      //每个地址等待arp响应时最多缓存的数据包数
+
+#define TIMER_TICK_MS 10 //时间轮的tick长度，毫秒
+
+#define LOG_LEVEL LOG_INFO //编译期日志级别，更详细的级别编译为空
+#define LOG_RING_LEN 1024  //日志环形缓冲区的记录数，2的幂，满了丢弃新记录
+#define LOG_MSG_LEN 112    //每条日志的最大长度，超出截断
+
+#define NET_TRACE            //在各层记录每个包的二进制跟踪，注释掉后跟踪点编译为空
+#define TRACE_RING_LEN 4096  //跟踪环的记录数，2的幂，满了覆盖最旧的记录
 
 #define IP_DEFALUT_TTL 64 //IP默认TTL
 
-#define BUF_MAX_LEN (2 * UINT16_MAX + UINT8_MAX) //buf最大长度
+#define BUF_MAX_LEN (2 * UINT16_MAX + UINT8_MAX) //buf最大长度，即最大的size class
+
+#define BUF_HEADROOM 128                                 //buf_init为协议头预留的头部空间
+#define BUF_CLASS_SMALL 256                              //协议头和短报文的size class
+#define BUF_CLASS_FRAME 2048                             //以太网帧的size class
+#define BUF_CLASS_WINDOW (BUF_HEADROOM + UINT16_MAX + 1) //分片重组和tcp收发窗口的size class
+
+#define BUF_POOL_MAX_FREE 16 //缓冲池每个size class最多缓存的空闲数量
+
+#define TCP_WINDOW_LEN UINT16_MAX //tcp收发缓存大小
+#define TCP_IDLE_TIMEOUT_SEC (60 * 5) //tcp连接空闲超时时间，超时后释放连接
 
-#define MAP_MAX_LEN (16 * BUF_MAX_LEN) //map最大长度
 #endif
\ No newline at end of file
@@ -0,0 +1,42 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdint.h>
+#include "config.h"
+
+#define LOG_ERROR 0
+#define LOG_WARN 1
+#define LOG_INFO 2
+#define LOG_DEBUG 3
+
+extern int log_level;
+
+/**
+ * @brief 按级别记录日志，编译期级别LOG_LEVEL以上的调用被常量条件消去，
+ *        只做参数的类型检查；运行期级别log_level以上的调用只比较一次
+ *
+ */
+#define LOG_AT(level, ...)                                     \
+    do                                                         \
+    {                                                          \
+        if ((level) <= LOG_LEVEL && (level) <= log_level)      \
+            log_write(level, __VA_ARGS__);                     \
+    } while (0)
+
+#define log_error(...) LOG_AT(LOG_ERROR, __VA_ARGS__)
+#define log_warn(...) LOG_AT(LOG_WARN, __VA_ARGS__)
+#define log_info(...) LOG_AT(LOG_INFO, __VA_ARGS__)
+#define log_debug(...) LOG_AT(LOG_DEBUG, __VA_ARGS__)
+
+typedef struct log_record //日志环形缓冲区里的一条记录
+{
+    uint64_t time;          //记录时间，net_now()的毫秒数
+    int level;              //日志级别
+    char msg[LOG_MSG_LEN];  //格式化好的消息，不含换行
+} log_record_t;
+
+int log_init();
+void log_set_level(int level);
+void log_write(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+void log_flush();
+#endif
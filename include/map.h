@@ -3,28 +3,100 @@
 
 #include <stdint.h>
 #include <stdlib.h>
-#include <time.h>
 #include "config.h"
 
 typedef void (*map_constuctor_t)(void *dst, const void *src, size_t len);
-typedef void (*map_entry_handler_t)(void *key, void *value, time_t *timestamp);
+typedef void (*map_destructor_t)(void *value);
+typedef void (*map_entry_handler_t)(void *key, void *value, uint64_t *timestamp);
+typedef int (*map_predicate_t)(void *key, void *value, void *arg);
+
+typedef enum map_key_type //键的比较方式，map_init按键的长度选择
+{
+    MAP_KEY_BYTES, //任意长度的键，逐字节比较
+    MAP_KEY_U16,   //2字节的键，如端口号，按整数比较
+    MAP_KEY_U32,   //4字节的键，如ip地址，按整数比较
+    MAP_KEY_U64,   //8字节的键，如tcp_key_t，按整数比较
+} map_key_type_t;
+
+typedef enum map_evict //满了以后的处理方式，用map_set_evict设置
+{
+    MAP_EVICT_NONE,  //插入失败
+    MAP_EVICT_CLOCK, //按CLOCK算法淘汰最近没有访问过的键值对，近似LRU
+} map_evict_t;
+
+typedef struct map_stats //map的统计计数，用于确定表的大小
+{
+    uint64_t lookups;      //map_get的次数
+    uint64_t hits;         //map_get找到的次数
+    uint64_t misses;       //map_get没有找到的次数，包括已超时的
+    uint64_t expired;      //读取时发现已超时而删除的次数
+    uint64_t finds;        //查找散列槽的次数，包括读取、插入、删除和刷新
+    uint64_t probes;       //查找时探测的组数之和
+    uint64_t max_probes;   //单次查找探测的最多组数
+    uint64_t inserts;      //插入新键的次数
+    uint64_t insert_fails; //插入失败的次数
+    uint64_t evictions;    //淘汰的次数
+    uint64_t rehashes;     //重新分配存储区的次数
+} map_stats_t;
 
 typedef struct map //协议栈的通用泛型map，即键值对的容器，支持超时时间与非平凡值类型
 {
     size_t key_len;                    //键的长度
+    map_key_type_t key_type;           //键的比较方式
     size_t value_len;                  //值的长度
     size_t size;                       //当前大小
     size_t max_size;                   //最大容量
-    time_t timeout;                    //超时时间，0为永不超时
+    uint64_t timeout;                  //超时毫秒数，0为永不超时
     map_constuctor_t value_constuctor; //形如memcpy的值构造函数，用于拷贝非平凡数据结构到容器中，如buf_copy
-    uint8_t data[MAP_MAX_LEN];         //数据
+    map_destructor_t value_destructor; //值的析构函数，键值对被删除、超时、覆盖或淘汰时调用，为NULL则不调用
+    map_evict_t evict;                 //满了以后的处理方式
+    size_t clock_hand;                 //CLOCK淘汰的指针，键值对下标
+    const char *name;                  //打印统计时的名字，用map_set_name设置
+    uint8_t concurrent;                //是否允许其他线程用map_read无锁读取，用map_set_concurrent设置
+    uint8_t write_lock;                //concurrent时写者的自旋锁
+    uint32_t seq;                      //concurrent时的顺序锁序号，写者修改期间为奇数
+    void *retired;                     //concurrent时被替换下来的旧存储区链表，读者可能还在读
+    size_t retired_count;              //退役链表的长度，不超过MAP_RETIRED_MAX
+    uint32_t readers;                  //concurrent时正在map_read的读者数，为0时才能释放旧存储区
+    map_stats_t stats;                 //统计计数
+    size_t entry_len;                  //键值对占用的长度，按8字节对齐
+    size_t entry_count;                //已使用的键值对数，包括已删除但未整理的
+    size_t entry_cap;                  //键值对数组的容量，为散列槽数的7/8，未分配存储区时为0
+    size_t slot_mask;                  //散列槽数减一，散列槽数为2的幂
+    size_t iterators;                  //正在进行的遍历数，不为0时不重新分配存储区
+    uint8_t *entries;                  //按插入顺序紧密排列的键值对，也是堆上存储区的起始地址
+    uint32_t *slots;                   //散列槽，存放键值对下标，位于存储区中
+    uint8_t *ctrl;                     //散列槽的控制字节，空、已删除或键的散列值低7位，位于存储区中
 } map_t;
 
-void map_init(map_t *map, size_t key_len, size_t value_len, size_t max_len, time_t timeout, map_constuctor_t value_constuctor);
+typedef struct map_iter //map的遍历游标，按插入顺序访问未删除且未超时的键值对
+{
+    map_t *map;         //正在遍历的map，遍历结束后为NULL
+    size_t index;       //下一个要检查的键值对下标
+    void *key;          //当前键值对的键
+    void *value;        //当前键值对的值
+    uint64_t *timestamp; //当前键值对的更新时间
+} map_iter_t;
+
+void map_init(map_t *map, size_t key_len, size_t value_len, size_t max_len, uint64_t timeout, map_constuctor_t value_constuctor);
 size_t map_size(map_t *map);
 void *map_get(map_t *map, const void *key);
+int map_read(map_t *map, const void *key, void *value);
 int map_set(map_t *map, const void *key, const void *value);
 void map_delete(map_t *map, const void *key);
+int map_touch(map_t *map, const void *key);
+void map_set_destructor(map_t *map, map_destructor_t value_destructor);
+void map_set_evict(map_t *map, map_evict_t evict);
+void map_set_concurrent(map_t *map);
 void map_foreach(map_t *map, map_entry_handler_t handler);
+void map_destroy(map_t *map);
+void map_set_name(map_t *map, const char *name);
+void map_stats_print(map_t *map);
+void map_stats_print_all();
+void map_iter_begin(map_t *map, map_iter_t *iter);
+int map_iter_next(map_iter_t *iter);
+void map_iter_delete(map_iter_t *iter);
+void map_iter_end(map_iter_t *iter);
+size_t map_delete_if(map_t *map, map_predicate_t predicate, void *arg);
 
 #endif
\ No newline at end of file
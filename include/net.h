@@ -23,10 +23,10 @@ typedef void (*net_handler_t)(buf_t *buf, uint8_t *src);
 
 extern uint8_t net_if_mac[NET_MAC_LEN];
 extern uint8_t net_if_ip[NET_IP_LEN];
-extern buf_t rxbuf, txbuf; //一个buf足够单线程使用
 
 int net_init();
 void net_poll();
+uint64_t net_now();
 int net_in(buf_t *buf, uint16_t protocol, uint8_t *src);
 void net_add_protocol(uint16_t protocol, net_handler_t handler);
 #endif
\ No newline at end of file
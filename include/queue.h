@@ -4,23 +4,77 @@
 #include <stdlib.h>
 #include <stdint.h>
 
-#define QUEUE_INIT_LEN 16
+#define QUEUE_INIT_LEN 16 // 初始容量，2的幂，满了翻倍
 
 typedef void (*queue_constuctor_t)(void *dst, const void *src, size_t len);
-// FIFO 循环队列
+// FIFO 循环队列，可增长，一般存放指针等句柄
 typedef struct queue
 {
-    void **data; // 数据
+    uint8_t *data; // 数据
     queue_constuctor_t value_constuctor;
-    size_t head;   // 队列头
-    size_t tail;   // 队列尾
+    size_t head;   // 队列头，单调递增，对容量取模得到位置
+    size_t tail;   // 队列尾，单调递增，tail - head为长度
     size_t item_size;
+    size_t capacity;   // 当前容量，2的幂
+    size_t max_len;    // 最大长度，0为不限制
+    size_t high_water; // 出现过的最大长度
+    size_t dropped;    // 因达到最大长度或内存不足而追加失败的次数
 } queue_t;
 
 queue_t* queue_init(size_t item_size, queue_constuctor_t value_constuctor);
+void queue_set_max_len(queue_t *queue, size_t max_len);
+size_t queue_len(queue_t *queue);
 int queue_append(queue_t *queue, void* item);
 int queue_get(queue_t *queue, void* dst);
 int queue_peek(queue_t *queue, void* dst);
 int queue_empty(queue_t * queue);
 int queue_destroy(queue_t *queue);
-#endif
\ No newline at end of file
+
+#define QUEUE_CACHE_LINE 64 // 缓存行长度，环形队列的生产者和消费者字段用它隔开，避免伪共享
+
+// 无锁单生产者单消费者环形队列，容量为2的幂，用于线程之间传递buf_t*等句柄
+// 只允许一个线程入队、一个线程出队
+typedef struct spsc
+{
+    uint8_t *data;    // 数据
+    size_t mask;      // 容量减一
+    size_t item_size; // 元素长度
+    uint8_t pad0[QUEUE_CACHE_LINE];
+    size_t tail;       // 生产者写入的位置，单调递增，消费者读取
+    size_t head_cache; // 生产者缓存的head，不够用时才重新读取
+    uint8_t pad1[QUEUE_CACHE_LINE];
+    size_t head;       // 消费者读取的位置，单调递增，生产者读取
+    size_t tail_cache; // 消费者缓存的tail
+    uint8_t pad2[QUEUE_CACHE_LINE];
+} spsc_t;
+
+spsc_t *spsc_init(size_t capacity, size_t item_size);
+int spsc_push(spsc_t *ring, const void *item);
+int spsc_pop(spsc_t *ring, void *dst);
+size_t spsc_push_batch(spsc_t *ring, const void *items, size_t n);
+size_t spsc_pop_batch(spsc_t *ring, void *dst, size_t n);
+size_t spsc_len(spsc_t *ring);
+void spsc_destroy(spsc_t *ring);
+
+// 有界无锁多生产者多消费者队列（Vyukov），容量为2的幂，用于把连接或请求分发给多个工作线程
+// 每个单元有一个序号，表示它可以被哪一轮的生产者写入或消费者读取
+typedef struct mpmc
+{
+    uint8_t *cells;   // 单元数组，每个单元是序号加元素
+    size_t mask;      // 容量减一
+    size_t item_size; // 元素长度
+    size_t cell_size; // 单元长度，按序号的长度对齐
+    uint8_t pad0[QUEUE_CACHE_LINE];
+    size_t tail; // 下一个入队位置，生产者竞争
+    uint8_t pad1[QUEUE_CACHE_LINE];
+    size_t head; // 下一个出队位置，消费者竞争
+    uint8_t pad2[QUEUE_CACHE_LINE];
+} mpmc_t;
+
+mpmc_t *mpmc_init(size_t capacity, size_t item_size);
+int mpmc_push(mpmc_t *queue, const void *item);
+int mpmc_pop(mpmc_t *queue, void *dst);
+size_t mpmc_pop_batch(mpmc_t *queue, void *dst, size_t n);
+size_t mpmc_depth(mpmc_t *queue);
+void mpmc_destroy(mpmc_t *queue);
+#endif
@@ -79,6 +79,8 @@ typedef struct tcp_connect {
     void* handler;
     buf_t* rx_buf; // 接收缓存
     buf_t* tx_buf; // 发送缓存
+    int ref;       // 引用计数，connect_table持有一个，应用层跨poll持有时用tcp_connect_get/tcp_connect_put
+    int removed;   // 已从connect_table删除，缓存已释放，读写和关闭不再生效，等引用放完后释放
 } tcp_connect_t;
 
 static const tcp_connect_t CONNECT_LISTEN = {
@@ -100,6 +102,9 @@ void tcp_init();
 int tcp_open(uint16_t port, tcp_handler_t handler);
 void tcp_close(uint16_t port);
 void tcp_connect_close(tcp_connect_t* connect);
+tcp_connect_t* tcp_connect_get(tcp_connect_t* connect);
+void tcp_connect_put(tcp_connect_t* connect);
+int tcp_connect_is_open(tcp_connect_t* connect);
 size_t tcp_connect_write(tcp_connect_t* connect, const uint8_t* data, size_t len);
 size_t tcp_connect_read(tcp_connect_t* connect, uint8_t* data, size_t len);
 void tcp_in(buf_t* buf, uint8_t* src_ip);
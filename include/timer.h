@@ -0,0 +1,29 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "config.h"
+
+#define TIMER_LEVEL_BITS 6                          //每层时间轮槽数的位数
+#define TIMER_LEVEL_SLOTS (1 << TIMER_LEVEL_BITS)   //每层时间轮的槽数
+#define TIMER_LEVELS 4                              //时间轮层数，可表示的最长时间为64^4个tick
+#define TIMER_MAX_TICKS ((uint64_t)1 << (TIMER_LEVEL_BITS * TIMER_LEVELS))
+
+typedef void (*timer_handler_t)(void *arg);
+
+typedef struct net_timer //挂在分层时间轮上的定时器，由使用者分配存储
+{
+    uint64_t expire;          //到期的tick
+    timer_handler_t handler;  //到期时调用的回调函数
+    void *arg;                //回调函数的参数
+    struct net_timer *next;   //所在槽的链表中的下一个
+    struct net_timer **pprev; //指向链表中上一个的next，不在时间轮中时为NULL
+} net_timer_t;
+
+void timer_init(uint64_t now);
+void timer_add(net_timer_t *timer, uint64_t expire, timer_handler_t handler, void *arg);
+void timer_cancel(net_timer_t *timer);
+int timer_pending(const net_timer_t *timer);
+void timer_poll(uint64_t now);
+#endif
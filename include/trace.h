@@ -0,0 +1,123 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+#include "net.h"
+
+#define TRACE_MAGIC "NTRC" //跟踪文件的魔数
+#define TRACE_VERSION 1    //跟踪文件格式版本，记录格式变化时递增
+
+typedef enum trace_layer
+{
+    TRACE_DRIVER,
+    TRACE_ETHERNET,
+    TRACE_ARP,
+    TRACE_IP,
+    TRACE_TCP,
+} trace_layer_t;
+
+typedef enum trace_event
+{
+    TRACE_IN,    //收到数据包
+    TRACE_OUT,   //发送数据包
+    TRACE_STATE, //连接状态变化，verdict为新状态
+} trace_event_t;
+
+typedef enum trace_verdict
+{
+    TRACE_PASS,   //交给下一层或发出
+    TRACE_DROP,   //丢弃
+    TRACE_QUEUED, //缓存起来等待arp响应
+    TRACE_REJECT, //丢弃并回复icmp差错报文
+} trace_verdict_t;
+
+typedef struct trace_record //二进制跟踪记录，定长32字节，多字节字段为主机序
+{
+    uint64_t time;       //记录时间，net_now()的毫秒数
+    uint32_t seq;        //全局序号，同一毫秒内的记录按它排序
+    uint8_t layer;       //trace_layer_t
+    uint8_t event;       //trace_event_t
+    uint8_t verdict;     //trace_verdict_t，TRACE_STATE时为tcp_state_t
+    uint8_t reserved;
+    uint16_t protocol;   //以太网类型或ip协议号
+    uint16_t src_port;
+    uint16_t dst_port;
+    uint16_t len;        //数据包长度
+    uint8_t src_ip[4];
+    uint8_t dst_ip[4];
+} trace_record_t;
+
+typedef struct trace_file_hdr //trace_dump写出的文件头，后面跟count条记录，从旧到新
+{
+    char magic[4];        //TRACE_MAGIC
+    uint16_t version;     //TRACE_VERSION
+    uint16_t record_size; //sizeof(trace_record_t)
+    uint32_t count;       //记录条数
+    uint32_t reserved;
+    uint64_t lost;        //被覆盖掉的更早的记录数
+} trace_file_hdr_t;
+
+/**
+ * @brief 记录一个跟踪点，没有定义NET_TRACE时成为常量为假的分支，编译为空，只检查参数
+ *        参数为layer, event, verdict, protocol, src_ip, dst_ip, src_port, dst_port, len，ip可以为NULL
+ *
+ */
+#ifdef NET_TRACE
+#define TRACE(...) trace_write(__VA_ARGS__)
+#else
+#define TRACE(...)                     \
+    do                                 \
+    {                                  \
+        if (0)                         \
+            trace_write(__VA_ARGS__);  \
+    } while (0)
+#endif
+
+extern trace_record_t trace_ring[TRACE_RING_LEN];
+extern uint64_t trace_seq;
+
+/**
+ * @brief 写入一条跟踪记录，一般通过TRACE宏调用
+ *        内联展开，只递增序号再填写对应的槽，不加锁也不做I/O，
+ *        协议栈是单线程的（见http.c），只能在调用net_poll的线程调用
+ *
+ * @param layer 所在的层
+ * @param event 事件
+ * @param verdict 处理结果
+ * @param protocol 以太网类型或ip协议号
+ * @param src_ip 源ip地址，没有为NULL
+ * @param dst_ip 目的ip地址，没有为NULL
+ * @param src_port 源端口（主机序）
+ * @param dst_port 目的端口（主机序）
+ * @param len 数据包长度
+ */
+static inline void trace_write(uint8_t layer, uint8_t event, uint8_t verdict, uint16_t protocol,
+                               const uint8_t *src_ip, const uint8_t *dst_ip, uint16_t src_port, uint16_t dst_port, size_t len)
+{
+    uint64_t seq = trace_seq++;
+    trace_record_t *record = &trace_ring[seq & (TRACE_RING_LEN - 1)];
+    record->time = net_now();
+    record->seq = (uint32_t)seq;
+    record->layer = layer;
+    record->event = event;
+    record->verdict = verdict;
+    record->reserved = 0;
+    record->protocol = protocol;
+    record->src_port = src_port;
+    record->dst_port = dst_port;
+    record->len = len > UINT16_MAX ? UINT16_MAX : len;
+    if (src_ip)
+        memcpy(record->src_ip, src_ip, sizeof(record->src_ip));
+    else
+        memset(record->src_ip, 0, sizeof(record->src_ip));
+    if (dst_ip)
+        memcpy(record->dst_ip, dst_ip, sizeof(record->dst_ip));
+    else
+        memset(record->dst_ip, 0, sizeof(record->dst_ip));
+}
+
+int trace_dump(const char *path);
+#endif
@@ -1,10 +1,17 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include <time.h>
 
-uint16_t checksum16(uint16_t *data, size_t len);
+uint16_t checksum16(const void *data, size_t len);
+uint32_t checksum16_partial(const void *data, size_t len, uint32_t sum);
+uint16_t checksum16_finish(uint32_t sum);
+uint32_t memcpy_csum(void *dst, const void *src, size_t len, uint32_t sum);
+uint32_t checksum16_pseudo(const uint8_t *src_ip, const uint8_t *dst_ip, uint8_t protocol, uint16_t len);
+uint16_t checksum16_update(uint16_t checksum, uint16_t old_field, uint16_t new_field);
+uint16_t checksum16_update_bytes(uint16_t checksum, const void *old_data, const void *new_data, size_t len);
 
 #define constswap16(x) ((((x)&0xFF) << 8) | (((x) >> 8) & 0xFF)) //为16位数据交换大小端
 //为16位数据交换大小端
@@ -3,6 +3,7 @@
 #include "net.h"
 #include "arp.h"
 #include "queue.h"
+#include "trace.h"
 #include "ethernet.h"
 /**
  * @brief 初始的arp包
@@ -24,25 +25,52 @@ static const arp_pkt_t arp_init_pkt = {
 map_t arp_table;
 
 /**
- * @brief arp buffer，<ip,buf_t>的容器
+ * @brief arp buffer，<ip,queue_t*>的容器，队列中是等待arp响应的buf_t*引用
  * 
  */
 map_t arp_buf;
 
+/**
+ * @brief arp_buf的值析构函数，表项删除或超时时释放等待的数据包和队列
+ * 
+ * @param value queue_t*的指针
+ */
+static void arp_buf_destroy(void *value)
+{
+    queue_t *queue = *(queue_t **)value;
+    buf_t *pending;
+    while (queue_get(queue, &pending) == 0)
+        buf_put(pending);
+    queue_destroy(queue);
+}
+
 /**
  * @brief 打印一条arp表项
  * 
  * @param ip 表项的ip地址
  * @param mac 表项的mac地址
- * @param timestamp 表项的更新时间
+ * @param timestamp 表项的更新时间，毫秒
  */
-void arp_entry_print(void *ip, void *mac, time_t *timestamp)
+void arp_entry_print(void *ip, void *mac, uint64_t *timestamp)
 {
-    printf("%s | %s | %s\n", iptos(ip), mactos(mac), timetos(*timestamp));
+    printf("%s | %s | %s\n", iptos(ip), mactos(mac), timetos(*timestamp / 1000));
 }
 
 /**
- * @brief 打印整个arp表
+ * @brief 打印一个等待arp响应的地址的缓存队列
+ * 
+ * @param ip 等待的ip地址
+ * @param queue queue_t*的指针
+ * @param timestamp 发出arp请求的时间，毫秒
+ */
+static void arp_pending_print(void *ip, void *queue, uint64_t *timestamp)
+{
+    queue_t *pending = *(queue_t **)queue;
+    printf("%s | pending %zu | max %zu | dropped %zu\n", iptos(ip), queue_len(pending), pending->high_water, pending->dropped);
+}
+
+/**
+ * @brief 打印整个arp表、等待arp响应的缓存队列，以及协议栈各个map的统计
  * 
  */
 void arp_print()
@@ -50,6 +78,12 @@ void arp_print()
     printf("===ARP TABLE BEGIN===\n");
     map_foreach(&arp_table, arp_entry_print);
     printf("===ARP TABLE  END ===\n");
+    printf("===ARP PENDING BEGIN===\n");
+    map_foreach(&arp_buf, arp_pending_print);
+    printf("===ARP PENDING  END ===\n");
+    printf("===MAP STATS BEGIN===\n");
+    map_stats_print_all();
+    printf("===MAP STATS  END ===\n");
 }
 
 /**
@@ -59,9 +93,8 @@ void arp_print()
  */
 void arp_req(uint8_t *target_ip)
 {
-    buf_t *buf = &rxbuf;
-    memset(buf,0,sizeof(buf_t));
-    buf_init(buf, sizeof(arp_pkt_t));
+    buf_t *buf = buf_alloc(sizeof(arp_pkt_t));
+    if (buf == NULL) return;
     arp_pkt_t *pkt = (arp_pkt_t*)buf->data;
     memcpy(pkt, &arp_init_pkt, sizeof(arp_pkt_t));
 
@@ -71,6 +104,7 @@ void arp_req(uint8_t *target_ip)
     memcpy(pkt->target_ip, target_ip, NET_MAC_LEN);
     buf_add_padding(buf, ARP_PADDING);
     ethernet_out(buf, ether_broadcast_mac, NET_PROTOCOL_ARP);
+    buf_put(buf);
 }
 
 /**
@@ -81,9 +115,8 @@ void arp_req(uint8_t *target_ip)
  */
 void arp_resp(uint8_t *target_ip, uint8_t *target_mac)
 {
-    buf_t *buf = &txbuf;
-    memset(buf,0,sizeof(buf_t));
-    buf_init(buf, sizeof(arp_pkt_t));
+    buf_t *buf = buf_alloc(sizeof(arp_pkt_t));
+    if (buf == NULL) return;
     arp_pkt_t *pkt = (arp_pkt_t*)buf->data;
     memcpy(pkt, &arp_init_pkt, sizeof(arp_pkt_t));
 
@@ -93,6 +126,7 @@ void arp_resp(uint8_t *target_ip, uint8_t *target_mac)
     memcpy(pkt->target_ip, target_ip, NET_MAC_LEN*sizeof(uint8_t));
     buf_add_padding(buf, ARP_PADDING);
     ethernet_out(buf, target_mac, NET_PROTOCOL_ARP);
+    buf_put(buf);
 }
 
 /**
@@ -121,12 +155,12 @@ void arp_in(buf_t *buf, uint8_t *src_mac)
         // 清空缓存
         while (!queue_empty(queue))
         {
-            buf_t* buf = &txbuf;
-            queue_get(queue, buf);
-            ethernet_out(buf, pkt->sender_mac, NET_PROTOCOL_IP);
+            buf_t* pending;
+            queue_get(queue, &pending);
+            ethernet_out(pending, pkt->sender_mac, NET_PROTOCOL_IP);
+            buf_put(pending);
         }
         map_delete(&arp_buf, pkt->sender_ip);
-        queue_destroy(queue);
     }
 
     if (pkt->opcode16 == constswap16(ARP_REQUEST))
@@ -140,6 +174,7 @@ void arp_in(buf_t *buf, uint8_t *src_mac)
 
 /**
  * @brief 处理一个要发送的数据包
+ *        需要缓存时，非池化的buf的存储区会被转移到缓存队列中，调用者不应再使用其数据
  * 
  * @param buf 要处理的数据包
  * @param ip 目标ip地址
@@ -147,26 +182,59 @@ void arp_in(buf_t *buf, uint8_t *src_mac)
  */
 void arp_out(buf_t *buf, uint8_t *ip)
 {
-    uint8_t *target_mac = (uint8_t*)map_get(&arp_table, ip);
-    if(target_mac == NULL)
+    // 拷贝出mac地址，arp表可以被其他线程无锁读取
+    uint8_t target_mac[NET_MAC_LEN];
+    if (map_read(&arp_table, ip, target_mac) != 0)
     {
+        size_t len = buf_chain_len(buf);
         queue_t** queue_p = map_get(&arp_buf, ip);
         queue_t* queue = NULL;
+        // 队列中只保存buffer的引用：池化的buffer只增加引用计数，引用外部存储（如pcap的帧缓冲）的
+        // buffer由buf_get拷贝到缓冲池，外部存储在返回后就会被复用；
+        // 静态区或栈上的buffer存储区属于缓冲池，直接接管，不拷贝数据包
+        buf_t* pending;
+        if (buf->ref || buf->external)
+            pending = buf_get(buf);
+        else
+        {
+            pending = buf_alloc(0);
+            if (pending != NULL && buf_move(pending, buf) != 0)
+            {
+                buf_put(pending);
+                return;
+            }
+        }
+        if (pending == NULL) return;
         if (queue_p == NULL)
         {
-            queue = queue_init(sizeof(buf_t),buf_copy);
-            map_set(&arp_buf, ip, &queue);
-            queue_append(queue, buf);
+            queue = queue_init(sizeof(buf_t*), NULL);
+            if (queue == NULL || map_set(&arp_buf, ip, &queue) != 0)
+            {
+                if (queue)
+                    queue_destroy(queue);
+                buf_put(pending);
+                return;
+            }
+            queue_set_max_len(queue, ARP_MAX_PENDING);
+            queue_append(queue, &pending);
+            TRACE(TRACE_ARP, TRACE_OUT, TRACE_QUEUED, NET_PROTOCOL_IP, net_if_ip, ip, 0, 0, len);
             arp_req(ip);
         }
         else
         {
             queue = *queue_p;
-            queue_append(queue, buf);
+            if (queue_append(queue, &pending) != 0)
+            {
+                TRACE(TRACE_ARP, TRACE_OUT, TRACE_DROP, NET_PROTOCOL_IP, net_if_ip, ip, 0, 0, len);
+                buf_put(pending);
+            }
+            else
+                TRACE(TRACE_ARP, TRACE_OUT, TRACE_QUEUED, NET_PROTOCOL_IP, net_if_ip, ip, 0, 0, len);
         }
         
         return;
     }
+    TRACE(TRACE_ARP, TRACE_OUT, TRACE_PASS, NET_PROTOCOL_IP, net_if_ip, ip, 0, 0, buf_chain_len(buf));
     ethernet_out(buf, target_mac, NET_PROTOCOL_IP);
 }
 
@@ -176,9 +244,16 @@ void arp_out(buf_t *buf, uint8_t *ip)
  */
 void arp_init()
 {
-    map_init(&arp_table, NET_IP_LEN, NET_MAC_LEN, 0, ARP_TIMEOUT_SEC, NULL);
+    map_init(&arp_table, NET_IP_LEN, NET_MAC_LEN, ARP_MAX_ENTRY, ARP_TIMEOUT_SEC * 1000, NULL);
+    map_set_evict(&arp_table, MAP_EVICT_CLOCK);
+    map_set_name(&arp_table, "arp_table");
+#ifdef NET_CONCURRENT_TABLES
+    map_set_concurrent(&arp_table);
+#endif
     // buf map使用队列
-    map_init(&arp_buf, NET_IP_LEN, sizeof(queue_t*), 0, ARP_MIN_INTERVAL, NULL);
+    map_init(&arp_buf, NET_IP_LEN, sizeof(queue_t*), 0, ARP_MIN_INTERVAL * 1000, NULL);
+    map_set_name(&arp_buf, "arp_buf");
+    map_set_destructor(&arp_buf, arp_buf_destroy);
     net_add_protocol(NET_PROTOCOL_ARP, arp_in);
     arp_req(net_if_ip);
 }
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include "buf.h"
+#include "utils.h"
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
@@ -6,8 +7,114 @@
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wformat="
 #pragma GCC diagnostic ignored "-Wformat-extra-args"
+
+#define BUF_CLASS_NUM 4
+
+/**
+ * @brief 存储区的各个size class，从小到大
+ * 
+ */
+static const size_t buf_class_size[BUF_CLASS_NUM] = {BUF_CLASS_SMALL, BUF_CLASS_FRAME, BUF_CLASS_WINDOW, BUF_MAX_LEN};
+
+/**
+ * @brief 各size class的空闲存储区链表，链接指针存放在存储区的开头
+ * 
+ */
+static void *buf_class_free[BUF_CLASS_NUM];
+static size_t buf_class_free_count[BUF_CLASS_NUM];
+
+/**
+ * @brief 缓冲池空闲链表，buf_put归还的buffer缓存在这里供buf_alloc复用
+ * 
+ */
+static buf_t *buf_pool_free;
+static size_t buf_pool_free_count;
+
+/**
+ * @brief 内部函数，查找能容纳size字节的最小size class
+ * 
+ * @param size 需要的大小
+ * @return int size class下标，没有足够大的为-1
+ */
+static int buf_class_of(size_t size)
+{
+    for (int i = 0; i < BUF_CLASS_NUM; i++)
+        if (size <= buf_class_size[i])
+            return i;
+    return -1;
+}
+
+/**
+ * @brief 内部函数，释放buffer拥有的存储区，切片的存储区属于owner，外部存储区不属于协议栈，都不释放
+ * 
+ * @param buf 要释放存储区的buffer
+ */
+static void buf_storage_detach(buf_t *buf)
+{
+    if (buf->payload && !buf->owner && !buf->external)
+    {
+        int cls = buf_class_of(buf->cap);
+        if (buf_class_free_count[cls] >= BUF_POOL_MAX_FREE)
+            free(buf->payload);
+        else
+        {
+            *(void **)buf->payload = buf_class_free[cls];
+            buf_class_free[cls] = buf->payload;
+            buf_class_free_count[cls]++;
+        }
+    }
+    buf->payload = NULL;
+    buf->data = NULL;
+    buf->cap = 0;
+    buf->len = 0;
+    buf->external = 0;
+}
+
+/**
+ * @brief 内部函数，为buffer分配能容纳size字节的存储区，原有的存储区被释放
+ * 
+ * @param buf 要分配存储区的buffer
+ * @param size 需要的大小
+ * @return int 成功为0，失败为-1
+ */
+static int buf_storage_attach(buf_t *buf, size_t size)
+{
+    int cls = buf_class_of(size);
+    if (cls < 0)
+        return -1;
+    uint8_t *storage = buf_class_free[cls];
+    if (storage)
+    {
+        buf_class_free[cls] = *(void **)storage;
+        buf_class_free_count[cls]--;
+    }
+    else if ((storage = malloc(buf_class_size[cls])) == NULL)
+        return -1;
+    buf_storage_detach(buf);
+    buf->payload = storage;
+    buf->cap = buf_class_size[cls];
+    return 0;
+}
+
+/**
+ * @brief 内部函数，存储区更换后重新定位各层协议头，不在拷贝区域[from, from+len)内的置为NULL
+ * 
+ * @param p 原来的协议头位置
+ * @param from 拷贝区域在原存储区的起始地址
+ * @param len 拷贝区域的长度
+ * @param to 拷贝区域在新存储区的起始地址
+ * @return uint8_t* 新的协议头位置
+ */
+static uint8_t *buf_rebase(uint8_t *p, const uint8_t *from, size_t len, uint8_t *to)
+{
+    if (p == NULL || p < from || p >= from + len)
+        return NULL;
+    return to + (p - from);
+}
+
 /**
  * @brief 初始化buffer为给定的长度，用于装载数据包
+ *        数据前预留BUF_HEADROOM字节的头部空间，存储区不够或在外部时按size class重新分配
  * 
  * @param buf 要初始化的buffer
  * @param len 数据初始长度
@@ -15,19 +122,21 @@
  */
 int buf_init(buf_t *buf, size_t len)
 {
-    if (len >= BUF_MAX_LEN / 2)
+    if (buf->owner || ((buf->external || BUF_HEADROOM + len > buf->cap) && buf_storage_attach(buf, BUF_HEADROOM + len) != 0))
     {
         fprintf(stderr, "Error in buf_init:%zu\n", len);
         return -1;
     }
 
     buf->len = len;
-    buf->data = buf->payload + BUF_MAX_LEN / 2 - len;
+    buf->data = buf->payload + BUF_HEADROOM;
+    buf->l2 = buf->l3 = buf->l4 = NULL;
     return 0;
 }
 
 /**
  * @brief 为buffer在头部增加一段长度，用于添加协议头
+ *        外部存储区的头部空间不够时先拷贝到协议栈的存储区
  * 
  * @param buf 要修改的buffer
  * @param len 增加的长度
@@ -35,7 +144,9 @@ int buf_init(buf_t *buf, size_t len)
  */
 int buf_add_header(buf_t *buf, size_t len)
 {
-    if (buf->data - len < buf->payload)
+    if (buf->external && buf->data - len < buf->payload)
+        buf_reserve(buf, 0);
+    if (buf->owner || buf->data - len < buf->payload)
     {
         fprintf(stderr, "Error in buf_add_header:%zu+%zu\n", buf->len, len);
         return -1;
@@ -66,6 +177,8 @@ int buf_remove_header(buf_t *buf, size_t len)
 
 /**
  * @brief 为buffer在尾部添加一段长度，填充0
+ *        对scatter-gather链填充在最后一段，若最后一段是切片则追加一个新段
+ *        外部存储区不能在尾部扩展，先拷贝到协议栈的存储区
  * 
  * @param buf 要修改的buffer
  * @param len 添加的长度
@@ -73,7 +186,20 @@ int buf_remove_header(buf_t *buf, size_t len)
  */
 int buf_add_padding(buf_t *buf, size_t len)
 {
-    if (buf->data + buf->len + len >= buf->payload + BUF_MAX_LEN)
+    while (buf->next)
+        buf = buf->next;
+    if (buf->owner)
+    {
+        buf_t *pad = buf_alloc(len);
+        if (pad == NULL)
+            return -1;
+        memset(pad->data, 0, len);
+        buf->next = pad;
+        return 0;
+    }
+    if (buf->external && buf_reserve(buf, len) != 0)
+        return -1;
+    if (buf->data + buf->len + len >= buf->payload + buf->cap)
     {
         fprintf(stderr, "Error in buf_add_padding:%zu+%zu\n", buf->len, len);
         return -1;
@@ -102,7 +228,52 @@ int buf_remove_padding(buf_t *buf, size_t len)
 }
 
 /**
- * @brief buf拷贝构造函数
+ * @brief 确保buffer尾部还能添加len字节，存储区不够时换用更大的size class
+ *        外部存储区总是拷贝到协议栈的存储区，连同data之前已解析的协议头一起拷贝，并在前面预留BUF_HEADROOM
+ *        切片或被共享的buffer不能更换存储区
+ * 
+ * @param buf 要修改的buffer
+ * @param len 需要的尾部空间
+ * @return int 成功为0，失败为-1
+ */
+int buf_reserve(buf_t *buf, size_t len)
+{
+    size_t offset = buf->data - buf->payload;
+    if (buf->payload && !buf->external && offset + buf->len + len < buf->cap)
+        return 0;
+    if (buf->owner || buf->ref > 1)
+    {
+        fprintf(stderr, "Error in buf_reserve:%zu+%zu\n", buf->len, len);
+        return -1;
+    }
+    buf_t old = *buf;
+    size_t headroom = old.external ? BUF_HEADROOM : 0;
+    buf->payload = NULL;
+    buf->cap = 0;
+    buf->external = 0;
+    if (buf_storage_attach(buf, headroom + offset + old.len + len + 1) != 0)
+    {
+        *buf = old;
+        fprintf(stderr, "Error in buf_reserve:%zu+%zu\n", buf->len, len);
+        return -1;
+    }
+    buf->data = buf->payload + headroom + offset;
+    buf->len = old.len;
+    uint8_t *from = old.external ? old.payload : old.data;
+    uint8_t *to = old.external ? buf->payload + headroom : buf->data;
+    size_t copy_len = old.external ? offset + old.len : old.len;
+    if (old.payload)
+        memcpy(to, from, copy_len);
+    buf->l2 = buf_rebase(old.l2, from, copy_len, to);
+    buf->l3 = buf_rebase(old.l3, from, copy_len, to);
+    buf->l4 = buf_rebase(old.l4, from, copy_len, to);
+    buf_storage_detach(&old);
+    return 0;
+}
+
+/**
+ * @brief buf拷贝函数，只拷贝链头一段的有效数据，dst预留BUF_HEADROOM的头部空间
+ *        dst必须是已初始化或清零的buffer，原有的存储区不够时重新分配，拷贝后dst不属于缓冲池
  * 
  * @param pdst 目的buffer
  * @param psrc 源buffer
@@ -112,12 +283,342 @@ void buf_copy(void *pdst, const void *psrc, size_t len)
 {
     buf_t *dst = pdst;
     const buf_t *src = psrc;
-    assert(src->data >= src->payload);
-    assert(src->len <= BUF_MAX_LEN);
-    assert(src->data + src->len < src->payload + BUF_MAX_LEN);
+    assert(src->len == 0 || src->data + src->len <= src->payload + src->cap);
+    if (buf_init(dst, src->len) != 0)
+    {
+        fprintf(stderr, "Error in buf_copy:%zu\n", src->len);
+        return;
+    }
+    dst->ref = 0;
+    dst->pool_next = NULL;
+    dst->next = NULL;
+    memcpy(dst->data, src->data, src->len);
+    dst->l2 = buf_rebase(src->l2, src->data, src->len, dst->data);
+    dst->l3 = buf_rebase(src->l3, src->data, src->len, dst->data);
+    dst->l4 = buf_rebase(src->l4, src->data, src->len, dst->data);
+    memcpy(dst->src_ip, src->src_ip, sizeof(dst->src_ip));
+    memcpy(dst->dst_ip, src->dst_ip, sizeof(dst->dst_ip));
+    dst->src_port = src->src_port;
+    dst->dst_port = src->dst_port;
+}
+
+/**
+ * @brief 把src的数据（包括存储区和scatter-gather链）转移给dst，不拷贝数据
+ *        dst原有的存储区被释放，src变为没有存储区的空buffer，引用计数不变
+ *        还有切片引用src时不能转移
+ * 
+ * @param dst 目的buffer
+ * @param src 源buffer
+ * @return int 成功为0，失败为-1
+ */
+int buf_move(buf_t *dst, buf_t *src)
+{
+    if (src->ref > 1 || dst->next)
+    {
+        fprintf(stderr, "Error in buf_move:%d\n", src->ref);
+        return -1;
+    }
+    buf_storage_detach(dst);
+    buf_put(dst->owner);
     dst->len = src->len;
-    dst->data = dst->payload + (src->data - src->payload);
-    memcpy(dst->payload, src->payload, BUF_MAX_LEN);
+    dst->data = src->data;
+    dst->payload = src->payload;
+    dst->cap = src->cap;
+    dst->next = src->next;
+    dst->owner = src->owner;
+    dst->external = src->external;
+    dst->l2 = src->l2;
+    dst->l3 = src->l3;
+    dst->l4 = src->l4;
+    memcpy(dst->src_ip, src->src_ip, sizeof(dst->src_ip));
+    memcpy(dst->dst_ip, src->dst_ip, sizeof(dst->dst_ip));
+    dst->src_port = src->src_port;
+    dst->dst_port = src->dst_port;
+    src->external = 0;
+    src->l2 = src->l3 = src->l4 = NULL;
+    src->len = 0;
+    src->data = NULL;
+    src->payload = NULL;
+    src->cap = 0;
+    src->next = NULL;
+    src->owner = NULL;
+    return 0;
+}
+
+/**
+ * @brief 让buffer直接引用外部的数据（如pcap的帧缓冲）而不拷贝，buffer原有的存储区被释放
+ *        外部数据只在本次处理期间有效，需要保留时buf_get会拷贝一份，需要扩展时会先拷贝到协议栈的存储区
+ * 
+ * @param buf 要修改的buffer
+ * @param data 外部数据
+ * @param len 数据长度
+ * @return int 成功为0，失败为-1
+ */
+int buf_wrap(buf_t *buf, uint8_t *data, size_t len)
+{
+    if (buf->owner || buf->ref > 1)
+    {
+        fprintf(stderr, "Error in buf_wrap:%zu\n", len);
+        return -1;
+    }
+    buf_storage_detach(buf);
+    buf->payload = data;
+    buf->data = data;
+    buf->cap = len;
+    buf->len = len;
+    buf->external = 1;
+    buf->l2 = buf->l3 = buf->l4 = NULL;
+    return 0;
+}
+
+/**
+ * @brief 内部函数，从缓冲池取一个没有存储区的buffer，引用计数为1
+ * 
+ * @return buf_t* 分配的buffer，失败为NULL
+ */
+static buf_t *buf_header_alloc()
+{
+    buf_t *buf = buf_pool_free;
+    if (buf)
+    {
+        buf_pool_free = buf->pool_next;
+        buf_pool_free_count--;
+    }
+    else if ((buf = malloc(sizeof(buf_t))) == NULL)
+        return NULL;
+    memset(buf, 0, sizeof(buf_t));
+    buf->ref = 1;
+    return buf;
+}
+
+/**
+ * @brief 从缓冲池分配一个buffer并初始化为给定的长度，引用计数为1
+ *        存储区取能容纳头部空间和数据的最小size class
+ * 
+ * @param len 数据初始长度
+ * @return buf_t* 分配的buffer，失败为NULL
+ */
+buf_t *buf_alloc(size_t len)
+{
+    buf_t *buf = buf_header_alloc();
+    if (buf == NULL)
+    {
+        fprintf(stderr, "Error in buf_alloc:%zu\n", len);
+        return NULL;
+    }
+    if (buf_init(buf, len) != 0)
+    {
+        buf_put(buf);
+        return NULL;
+    }
+    return buf;
+}
+
+/**
+ * @brief 获取buffer的一个引用，用于在调用返回后继续持有数据包
+ *        池化的buffer只增加引用计数，不发生拷贝；
+ *        静态区或栈上的buffer以及引用外部数据的buffer无法被持有，此时从缓冲池拷贝出一份
+ * 
+ * @param buf 要持有的buffer
+ * @return buf_t* 持有的buffer，用完后要调用buf_put，失败为NULL
+ */
+buf_t *buf_get(buf_t *buf)
+{
+    if (buf->ref > 0 && !buf->external)
+    {
+        buf->ref++;
+        return buf;
+    }
+    buf_t *copy = buf_header_alloc();
+    if (copy == NULL)
+        return NULL;
+    buf_copy(copy, buf, 0);
+    copy->ref = 1;
+    if (copy->payload == NULL)
+    {
+        buf_put(copy);
+        return NULL;
+    }
+    return copy;
+}
+
+/**
+ * @brief 释放buffer的一个引用，引用计数归零时归还缓冲池
+ *        同时释放其后的scatter-gather链与切片所引用的buffer
+ * 
+ * @param buf 要释放的buffer，可以为NULL或非池化的buffer，此时什么也不做
+ */
+void buf_put(buf_t *buf)
+{
+    while (buf != NULL && buf->ref > 0)
+    {
+        if (--buf->ref > 0)
+            return;
+        buf_t *next = buf->next;
+        buf_storage_detach(buf);
+        buf_put(buf->owner);
+        buf->next = NULL;
+        buf->owner = NULL;
+        if (buf_pool_free_count >= BUF_POOL_MAX_FREE)
+            free(buf);
+        else
+        {
+            buf->pool_next = buf_pool_free;
+            buf_pool_free = buf;
+            buf_pool_free_count++;
+        }
+        buf = next;
+    }
+}
+
+/**
+ * @brief 内部函数，为链上的一段生成切片，切片持有数据所属buffer的引用
+ * 
+ * @param seg 链上的一段
+ * @param offset 段内偏移
+ * @param len 切片长度
+ * @return buf_t* 切片，失败为NULL
+ */
+static buf_t *buf_slice_segment(buf_t *seg, size_t offset, size_t len)
+{
+    buf_t *root = seg->owner ? seg->owner : seg;
+    // 非池化的root会被拷贝到缓冲池中，只拷贝有效数据，所以按相对data的偏移定位
+    buf_t *owner = buf_get(root);
+    if (owner == NULL)
+        return NULL;
+    buf_t *slice = buf_header_alloc();
+    if (slice == NULL)
+    {
+        buf_put(owner);
+        return NULL;
+    }
+    slice->owner = owner;
+    slice->payload = owner->payload;
+    slice->cap = owner->cap;
+    slice->data = owner->data + (seg->data - root->data) + offset;
+    slice->len = len;
+    return slice;
+}
+
+/**
+ * @brief 生成buffer中[offset, offset+len)一段数据的切片链，不拷贝数据
+ *        切片只读，不能在其头部添加协议头
+ * 
+ * @param buf 要切片的buffer，可以是scatter-gather链
+ * @param offset 起始偏移
+ * @param len 切片长度
+ * @return buf_t* 切片链的链头，用完后要调用buf_put，失败为NULL
+ */
+buf_t *buf_slice(buf_t *buf, size_t offset, size_t len)
+{
+    buf_t *head = NULL;
+    buf_t **tail = &head;
+    for (buf_t *seg = buf; seg && len > 0; seg = seg->next)
+    {
+        if (offset >= seg->len)
+        {
+            offset -= seg->len;
+            continue;
+        }
+        size_t seg_len = seg->len - offset < len ? seg->len - offset : len;
+        buf_t *slice = buf_slice_segment(seg, offset, seg_len);
+        if (slice == NULL)
+        {
+            buf_put(head);
+            return NULL;
+        }
+        *tail = slice;
+        tail = &slice->next;
+        offset = 0;
+        len -= seg_len;
+    }
+    if (len > 0)
+    {
+        fprintf(stderr, "Error in buf_slice:%zu+%zu\n", offset, len);
+        buf_put(head);
+        return NULL;
+    }
+    return head;
+}
+
+/**
+ * @brief 把tail链接到head所在scatter-gather链的末尾，tail的引用转移给链头
+ * 
+ * @param head 链头
+ * @param tail 要链接的链
+ */
+void buf_chain(buf_t *head, buf_t *tail)
+{
+    while (head->next)
+        head = head->next;
+    head->next = tail;
+}
+
+/**
+ * @brief 获取scatter-gather链的总长度
+ * 
+ * @param buf 链头
+ * @return size_t 各段长度之和
+ */
+size_t buf_chain_len(const buf_t *buf)
+{
+    size_t len = 0;
+    for (; buf; buf = buf->next)
+        len += buf->len;
+    return len;
+}
+
+/**
+ * @brief 把scatter-gather链聚集拷贝到一段连续内存中，用于发送
+ * 
+ * @param buf 链头
+ * @param dst 目的内存
+ * @param max_len 目的内存大小
+ * @return size_t 拷贝的字节数，超出max_len的部分被截断
+ */
+size_t buf_gather(const buf_t *buf, uint8_t *dst, size_t max_len)
+{
+    size_t len = 0;
+    for (; buf && len < max_len; buf = buf->next)
+    {
+        size_t seg_len = buf->len < max_len - len ? buf->len : max_len - len;
+        memcpy(dst + len, buf->data, seg_len);
+        len += seg_len;
+    }
+    return len;
+}
+
+/**
+ * @brief 计算scatter-gather链的16位反码和，不取反，可以和其他部分的反码和累加
+ *        各段分别求和后合并，从奇数偏移开始的段要交换字节序
+ * 
+ * @param buf 链头
+ * @return uint32_t 16位反码和，与checksum16_partial相同
+ */
+uint32_t buf_checksum16_partial(const buf_t *buf)
+{
+    uint32_t sum = 0;
+    size_t offset = 0;
+    for (; buf; buf = buf->next)
+    {
+        uint32_t part = checksum16_partial(buf->data, buf->len, 0);
+        if (offset & 0x1)
+            part = swap16(part);
+        sum += part;
+        offset += buf->len;
+    }
+    return checksum16_partial(NULL, 0, sum);
+}
+
+/**
+ * @brief 计算scatter-gather链的16位校验和
+ * 
+ * @param buf 链头
+ * @return uint16_t 校验和，与checksum16相同以大端方式存储
+ */
+uint16_t buf_checksum16(const buf_t *buf)
+{
+    return checksum16_finish(buf_checksum16_partial(buf));
 }
 
 #pragma GCC diagnostic pop
@@ -1,5 +1,6 @@
 #include <pcap.h>
 #include "driver.h"
+#include "trace.h"
 
 #ifdef _WIN32
 #include <tchar.h>
@@ -149,6 +150,7 @@ int driver_open()
 }
 /**
  * @brief 试图从网卡接收数据包
+ *        定义了DRIVER_ZERO_COPY时buf直接引用pcap的帧缓冲，否则拷贝到buf的存储区中
  * 
  * @param buf 收到的数据包
  * @return int 数据包的长度，未收到为0，错误为-1
@@ -162,27 +164,45 @@ int driver_recv(buf_t *buf)
         return 0;
     else if (ret == 1)
     {
-        memcpy(buf->data, pkt_data, pkt_hdr->len);
-        buf->len = pkt_hdr->len;
-        return pkt_hdr->len;
+#ifdef DRIVER_ZERO_COPY
+        // pkt_data在下一次pcap_next_ex前有效，协议栈需要保留时会自行拷贝
+        if (buf_wrap(buf, (uint8_t *)pkt_data, pkt_hdr->caplen) != 0)
+            return -1;
+#else
+        if (buf_init(buf, pkt_hdr->caplen) != 0)
+            return -1;
+        memcpy(buf->data, pkt_data, pkt_hdr->caplen);
+#endif
+        return pkt_hdr->caplen;
     }
     fprintf(stderr, "Error in driver_recv.\n%s.\n", pcap_geterr(pcap));
     return -1;
 }
 /**
  * @brief 使用网卡发送一个数据包
+ *        scatter-gather链在此聚集为连续的帧
  * 
  * @param buf 要发送的数据包
  * @return int 成功为0，失败为-1
  */
 int driver_send(buf_t *buf)
 {
-    if (pcap_sendpacket(pcap, buf->data, buf->len) == -1)
+    static uint8_t frame[BUF_MAX_LEN];
+    const uint8_t *data = buf->data;
+    size_t len = buf->len;
+    if (buf->next)
+    {
+        len = buf_gather(buf, frame, sizeof(frame));
+        data = frame;
+    }
+    uint16_t protocol = len >= 14 ? (data[12] << 8) | data[13] : 0;
+    if (pcap_sendpacket(pcap, data, len) == -1)
     {
+        TRACE(TRACE_DRIVER, TRACE_OUT, TRACE_DROP, protocol, NULL, NULL, 0, 0, len);
         fprintf(stderr, "Error in driver_send.\n%s.\n", pcap_geterr(pcap));
         return -1;
     }
-
+    TRACE(TRACE_DRIVER, TRACE_OUT, TRACE_PASS, protocol, NULL, NULL, 0, 0, len);
     return 0;
 }
 /**
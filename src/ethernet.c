@@ -3,6 +3,7 @@
 #include "driver.h"
 #include "arp.h"
 #include "ip.h"
+#include "trace.h"
 /**
  * @brief 处理一个收到的数据包
  * 
@@ -19,27 +20,35 @@ void ethernet_in(buf_t *buf)
     ether_hdr_t *hdr = (ether_hdr_t *)(buf->data);
     uint8_t* dst = hdr->dst;
 
-    if (memcmp(dst, ether_broadcast_mac, NET_MAC_LEN) 
-    && memcmp(dst, net_if_mac, NET_MAC_LEN)) return;
-
     protocal = swap16(hdr->protocol16);
 
+    if (memcmp(dst, ether_broadcast_mac, NET_MAC_LEN) 
+    && memcmp(dst, net_if_mac, NET_MAC_LEN))
+    {
+        TRACE(TRACE_ETHERNET, TRACE_IN, TRACE_DROP, protocal, NULL, NULL, 0, 0, buf->len);
+        return;
+    }
+    TRACE(TRACE_ETHERNET, TRACE_IN, TRACE_PASS, protocal, NULL, NULL, 0, 0, buf->len);
+
+    buf->l2 = buf->data;
     buf_remove_header(buf, sizeof(ether_hdr_t));
+    buf->l3 = buf->data;
 
     net_in(buf, protocal, hdr->src);
 }
 /**
  * @brief 处理一个要发送的数据包
  * 
- * @param buf 要处理的数据包
+ * @param buf 要处理的数据包，可以是scatter-gather链，以太网头加在链头
  * @param mac 目标MAC地址
  * @param protocol 上层协议
  */
 void ethernet_out(buf_t *buf, const uint8_t *mac, net_protocol_t protocol)
 {
     // 检查长度，若不足46则填充
-    if (buf->len < ETHERNET_MIN_TRANSPORT_UNIT)
-        buf_add_padding(buf, ETHERNET_MIN_TRANSPORT_UNIT - buf->len);
+    size_t len = buf_chain_len(buf);
+    if (len < ETHERNET_MIN_TRANSPORT_UNIT)
+        buf_add_padding(buf, ETHERNET_MIN_TRANSPORT_UNIT - len);
 
     // 添加Eth包头
     buf_add_header(buf, sizeof(ether_hdr_t));
@@ -58,7 +67,6 @@ void ethernet_out(buf_t *buf, const uint8_t *mac, net_protocol_t protocol)
  */
 void ethernet_init()
 {
-    buf_init(&rxbuf, ETHERNET_MAX_TRANSPORT_UNIT + sizeof(ether_hdr_t));
 }
 
 /**
@@ -67,6 +75,10 @@ void ethernet_init()
  */
 void ethernet_poll()
 {
-    if (driver_recv(&rxbuf) > 0)
-        ethernet_in(&rxbuf);
+    buf_t *buf = buf_alloc(0);
+    if (buf == NULL)
+        return;
+    if (driver_recv(buf) > 0)
+        ethernet_in(buf);
+    buf_put(buf);
 }
@@ -4,50 +4,21 @@
 #include "net.h"
 #include "assert.h"
 
-#define TCP_FIFO_SIZE 40
+#include "queue.h"
+#include "log.h"
 
-typedef struct http_fifo {
-    tcp_connect_t* buffer[TCP_FIFO_SIZE];
-    uint8_t front, tail, count;
-} http_fifo_t;
+#define TCP_FIFO_SIZE 64   // 等待处理的连接数上限，满了直接关闭新连接
+#define HTTP_BATCH_SIZE 8  // http_server_run一次从队列取出的连接数
 
-static http_fifo_t http_fifo_v;
-
-static void http_fifo_init(http_fifo_t* fifo) {
-    fifo->count = 0;
-    fifo->front = 0;
-    fifo->tail = 0;
-}
-
-static int http_fifo_in(http_fifo_t* fifo, tcp_connect_t* tcp) {
-    if (fifo->count >= TCP_FIFO_SIZE) {
-        return -1;
-    }
-    fifo->buffer[fifo->front] = tcp;
-    fifo->front++;
-    if (fifo->front >= TCP_FIFO_SIZE) {
-        fifo->front = 0;
-    }
-    fifo->count++;
-    return 0;
-}
-
-static tcp_connect_t* http_fifo_out(http_fifo_t* fifo) {
-    if (fifo->count == 0) {
-        return NULL;
-    }
-    tcp_connect_t* tcp = fifo->buffer[fifo->tail];
-    fifo->tail++;
-    if (fifo->tail >= TCP_FIFO_SIZE) {
-        fifo->tail = 0;
-    }
-    fifo->count--;
-    return tcp;
-}
+// 已连接、等待处理的tcp_connect_t*，队列持有引用。
+// 服务器是单线程的：http_server_run在协议栈线程调用，处理时会重入net_poll，
+// net_poll、connect_table和tcp_connect_*都没有加锁，不能在其他线程调用
+static mpmc_t* http_queue;
 
+// 读一行，连接在等待期间被对端关闭、复位或超时删除时返回0
 static size_t get_line(tcp_connect_t* tcp, char* buf, size_t size) {
     size_t i = 0;
-    while (i < size) {
+    while (i < size && tcp_connect_is_open(tcp)) {
         char c;
         if (tcp_connect_read(tcp, (uint8_t*)&c, 1) > 0) {
             if (c == '\n') {
@@ -60,13 +31,16 @@ static size_t get_line(tcp_connect_t* tcp, char* buf, size_t size) {
         }
         net_poll();
     }
+    if (!tcp_connect_is_open(tcp)) {
+        i = 0;
+    }
     buf[i] = '\0';
     return i;
 }
 
 static size_t http_send(tcp_connect_t* tcp, const char* buf, size_t size) {
     size_t send = 0;
-    while (send < size) {
+    while (send < size && tcp_connect_is_open(tcp)) {
         send += tcp_connect_write(tcp, (const uint8_t*)buf + send, size - send);
         net_poll();
     }
@@ -75,7 +49,7 @@ static size_t http_send(tcp_connect_t* tcp, const char* buf, size_t size) {
 
 static void close_http(tcp_connect_t* tcp) {
     tcp_connect_close(tcp);
-    printf("http closed.\n");
+    log_info("http closed.");
 }
 
 static size_t phrase_http_resp(http_resp_hdr_t* response, char* buf) {
@@ -109,7 +83,7 @@ static size_t phrase_http_resp(http_resp_hdr_t* response, char* buf) {
     }
     // end
     write_idx += sprintf(buf + write_idx, "\r\n");
-    printf("--- --- header ---\n%s\n--- --- size: %d bytes ---\n", buf, write_idx);
+    log_debug("--- --- header size: %d bytes ---", write_idx);
     return write_idx;
 }
 
@@ -132,10 +106,10 @@ static void send_file(tcp_connect_t* tcp, const char* url) {
     }
     strcat(file_path, url);
 
-    printf("--- - getting file %s\n", file_path);
+    log_debug("--- - getting file %s", file_path);
 
     if((file = fopen(file_path, "rb")) == NULL) {
-        printf("--- -- %s not found\n", file_path);
+        log_info("--- -- %s not found", file_path);
         // build 404 resp
         http_resp_hdr_t resp;
         header_line_t lines[1];
@@ -145,13 +119,13 @@ static void send_file(tcp_connect_t* tcp, const char* url) {
         resp.status_code = HTTP_404_NOT_FOUND;
         resp.status_msg = msg;
         resp.headers = lines;
-        printf("--- -- sending 404\n");
+        log_debug("--- -- sending 404");
 
         phrase_http_resp(&resp, tx_buffer);
         http_send(tcp, tx_buffer, strlen(tx_buffer));
     } else {
         // build 200 resp
-        printf("--- -- found %s, sending\n", file_path);
+        log_debug("--- -- found %s, sending", file_path);
         http_resp_hdr_t resp;
 
         header_line_t lines[1];
@@ -168,7 +142,7 @@ static void send_file(tcp_connect_t* tcp, const char* url) {
 
         memset(tx_buffer, 0, BUFFER_SIZE);
         int read_size = 0;
-        while ((read_size = fread(tx_buffer, 1, BUFFER_SIZE, file)) > 0) {
+        while (tcp_connect_is_open(tcp) && (read_size = fread(tx_buffer, 1, BUFFER_SIZE, file)) > 0) {
             http_send(tcp, tx_buffer, read_size);
             memset(tx_buffer, 0, BUFFER_SIZE);
         }
@@ -178,11 +152,20 @@ static void send_file(tcp_connect_t* tcp, const char* url) {
 
 static void http_handler(tcp_connect_t* tcp, connect_state_t state) {
     if (state == TCP_CONN_CONNECTED) {
-        http_fifo_in(&http_fifo_v, tcp);
-        printf("http conntected.\n");
+        // 队列持有连接的引用，取出时连接可能已经被删除，但不会被释放
+        tcp_connect_t* held = tcp_connect_get(tcp);
+        if (mpmc_push(http_queue, &held) != 0) {
+            // 背压：处理不过来时拒绝新连接
+            log_warn("http queue full (%zu), closing.", mpmc_depth(http_queue));
+            tcp_connect_put(held);
+            tcp_connect_close(tcp);
+            return;
+        }
+        log_info("http conntected.");
     } else if (state == TCP_CONN_DATA_RECV) {
     } else if (state == TCP_CONN_CLOSED) {
-        printf("http closed.\n");
+        // 还在队列里的连接不用取出，http_server_run取到时发现已关闭就放掉引用
+        log_info("http closed.");
     } else {
         assert(0);
     }
@@ -192,60 +175,82 @@ static void http_handler(tcp_connect_t* tcp, connect_state_t state) {
 // 在端口上创建服务器。
 
 int http_server_open(uint16_t port) {
-    if (!tcp_open(port, http_handler)) {
+    if (http_queue == NULL) {
+        http_queue = mpmc_init(TCP_FIFO_SIZE, sizeof(tcp_connect_t*));
+        if (http_queue == NULL) {
+            return -1;
+        }
+    }
+    if (tcp_open(port, http_handler) != 0) {
         return -1;
     }
-    http_fifo_init(&http_fifo_v);
     return 0;
 }
 
-// 从FIFO取出请求并处理。新的HTTP请求时会发送到FIFO中等待处理。
+// 从队列批量取出连接并处理。新的HTTP连接会放入队列等待处理，只能在协议栈线程（调用net_poll的线程）调用。
 
 void http_server_run(void) {
     tcp_connect_t* tcp;
+    tcp_connect_t* batch[HTTP_BATCH_SIZE];
+    size_t n;
     // char url_path[255];
     char rx_buffer[1024] = {0};
 
-    while ((tcp = http_fifo_out(&http_fifo_v)) != NULL) {
-        int i;
-        char* c = rx_buffer;
-
-        /*
-        1、调用get_line从rx_buffer中获取一行数据，如果没有数据，则调用close_http关闭tcp，并继续循环
-        */
-        if (!get_line(tcp, c, 1024)) {
-            printf("no data");
-            close_http(tcp);
-            continue;
-        };
-
+    if (http_queue == NULL) {
+        return;
+    }
+    while ((n = mpmc_pop_batch(http_queue, batch, HTTP_BATCH_SIZE)) > 0) {
+        for (size_t k = 0; k < n; k++) {
+            tcp = batch[k];
+            int i;
+            char* c = rx_buffer;
+
+            // 等待处理期间已经被关闭或超时删除
+            if (!tcp_connect_is_open(tcp)) {
+                tcp_connect_put(tcp);
+                continue;
+            }
 
-        /*
-        2、检查是否有GET请求，如果没有，则调用close_http关闭tcp，并继续循环
-        */
-        if (strncmp(c, "GET", 3)) {
-            printf("--- bad request %s\n", c);
-            close_http(tcp);
-            continue;
-        }
+            /*
+            1、调用get_line从rx_buffer中获取一行数据，如果没有数据，则调用close_http关闭tcp，并继续循环
+            */
+            if (!get_line(tcp, c, 1024)) {
+                log_debug("no data");
+                close_http(tcp);
+                tcp_connect_put(tcp);
+                continue;
+            };
+
+
+            /*
+            2、检查是否有GET请求，如果没有，则调用close_http关闭tcp，并继续循环
+            */
+            if (strncmp(c, "GET", 3)) {
+                log_warn("--- bad request %s", c);
+                close_http(tcp);
+                tcp_connect_put(tcp);
+                continue;
+            }
 
 
-        /*
-        3、解析GET请求的路径，注意跳过空格，找到GET请求的文件，调用send_file发送文件
-        */
-        c += 4;
-        i = 0;
-        while(c[i++] != ' ');
-        i--;
-        c[i] = '\0';
-        send_file(tcp, c);
+            /*
+            3、解析GET请求的路径，注意跳过空格，找到GET请求的文件，调用send_file发送文件
+            */
+            c += 4;
+            i = 0;
+            while(c[i++] != ' ');
+            i--;
+            c[i] = '\0';
+            send_file(tcp, c);
 
 
-        /*
-        4、调用close_http关掉连接
-        */
-        close_http(tcp);
+            /*
+            4、调用close_http关掉连接
+            */
+            close_http(tcp);
+            tcp_connect_put(tcp);
 
-        printf("--- - !! final close\n");
+            log_debug("--- - !! final close");
+        }
     }
 }
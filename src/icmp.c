@@ -13,20 +13,21 @@ static void icmp_resp(buf_t *req_buf, uint8_t *src_ip)
     icmp_hdr_t* req_hdr = (icmp_hdr_t*)req_buf->data;
     uint16_t* req_data = (uint16_t*)(req_buf->data + sizeof(icmp_hdr_t));
     size_t data_len = req_buf->len - sizeof(icmp_hdr_t);
-    buf_t* buf = &txbuf;
-    buf_init(buf, data_len);
+    buf_t* buf = buf_alloc(data_len);
+    if (buf == NULL) return;
     memcpy(buf->data, req_data, data_len);
 
     buf_add_header(buf, sizeof(icmp_hdr_t));
     icmp_hdr_t* hdr = (icmp_hdr_t*)buf->data;
     hdr->type = ICMP_TYPE_ECHO_REPLY;
     hdr->code = 0;
-    hdr->checksum16 = 0;
     hdr->id16 = req_hdr->id16;
     hdr->seq16 = req_hdr->seq16;
-    hdr->checksum16 = checksum16((uint16_t*)hdr, buf->len);
+    // 响应和请求只有类型和代码不同，请求的校验和已经在icmp_in中验证过，增量更新即可
+    hdr->checksum16 = checksum16_update_bytes(req_hdr->checksum16, req_hdr, hdr, 2);
 
     ip_out(buf, src_ip, NET_PROTOCOL_ICMP);
+    buf_put(buf);
 }
 
 /**
@@ -40,12 +41,8 @@ void icmp_in(buf_t *buf, uint8_t *src_ip)
     if (buf->len < sizeof(icmp_hdr_t)) return;
     icmp_hdr_t* hdr = (icmp_hdr_t*)buf->data;
 
-    // checksum
-    uint16_t received_checksum = hdr->checksum16;
-    hdr->checksum16 = 0;
-    uint16_t cal_checksum = checksum16((uint16_t*)buf->data, buf->len);
-    if (received_checksum != cal_checksum) return;
-    hdr->checksum16 = received_checksum;
+    // checksum，连同校验和字段一起求和，正确时为0，不修改数据包（可能是驱动的只读帧缓冲）
+    if (checksum16(buf->data, buf->len) != 0) return;
 
     if (hdr->type == ICMP_TYPE_ECHO_REQUEST)
     {
@@ -56,15 +53,17 @@ void icmp_in(buf_t *buf, uint8_t *src_ip)
 /**
  * @brief 发送icmp不可达
  * 
- * @param recv_buf 收到的ip数据包
+ * @param recv_buf 收到的数据包，其ip头由ip_in记录在l3中
  * @param src_ip 源ip地址
  * @param code icmp code，协议不可达或端口不可达
  */
 void icmp_unreachable(buf_t *recv_buf, uint8_t *src_ip, icmp_code_t code)
 {
-    buf_t* buf = &txbuf;
-    buf_init(buf, sizeof(ip_hdr_t) + 8);
-    memcpy(buf->data, recv_buf->data, sizeof(ip_hdr_t) + 8);
+    buf_t* buf = buf_alloc(sizeof(ip_hdr_t) + 8);
+    if (buf == NULL) return;
+    // 收到的包的ip头由ip_in记录，上层不需要恢复
+    uint8_t *ip_hdr = recv_buf->l3 ? recv_buf->l3 : recv_buf->data;
+    memcpy(buf->data, ip_hdr, sizeof(ip_hdr_t) + 8);
 
     buf_add_header(buf, sizeof(icmp_hdr_t));
     icmp_hdr_t* hdr = (icmp_hdr_t*)buf->data;
@@ -76,6 +75,7 @@ void icmp_unreachable(buf_t *recv_buf, uint8_t *src_ip, icmp_code_t code)
     hdr->checksum16 = checksum16((uint16_t*)hdr, buf->len);
 
     ip_out(buf, src_ip, NET_PROTOCOL_ICMP);
+    buf_put(buf);
 }
 
 /**
@@ -3,9 +3,23 @@
 #include "ethernet.h"
 #include "arp.h"
 #include "icmp.h"
+#include "log.h"
+#include "trace.h"
 
 int ip_id = 0;
 
+/**
+ * @brief 内部函数，记录收到的ip包的跟踪
+ * 
+ * @param buf 收到的包，data指向ip头
+ * @param verdict 处理结果
+ */
+static void ip_in_trace(buf_t *buf, uint8_t verdict)
+{
+    ip_hdr_t *hdr = (ip_hdr_t *)buf->data;
+    TRACE(TRACE_IP, TRACE_IN, verdict, hdr->protocol, hdr->src_ip, hdr->dst_ip, 0, 0, buf->len);
+}
+
 /**
  * @brief 处理一个收到的数据包
  * 
@@ -20,24 +34,36 @@ void ip_in(buf_t *buf, uint8_t *src_mac)
     // 检查
     // 无视可选长度
     // version
-    if(hdr->version != IP_VERSION_4) return;
-
-    // checksum
-    uint16_t received_checksum = hdr->hdr_checksum16;
-
-    hdr->hdr_checksum16 = 0;
-    uint16_t cal_checksum = checksum16((uint16_t*)hdr, sizeof(ip_hdr_t));
+    if(hdr->version != IP_VERSION_4)
+    {
+        ip_in_trace(buf, TRACE_DROP);
+        return;
+    }
 
-    if (cal_checksum != received_checksum) return;
-    hdr->hdr_checksum16 = received_checksum;
+    // checksum，连同校验和字段一起求和，正确时为0，不修改数据包（可能是驱动的只读帧缓冲）
+    if (checksum16(hdr, sizeof(ip_hdr_t)) != 0)
+    {
+        ip_in_trace(buf, TRACE_DROP);
+        return;
+    }
 
     // ip
-    if(memcmp(hdr->dst_ip, net_if_ip, NET_IP_LEN)) return;
-    uint8_t src_ip[NET_IP_LEN];
-    memcpy(src_ip, hdr->src_ip, NET_IP_LEN);
+    if(memcmp(hdr->dst_ip, net_if_ip, NET_IP_LEN))
+    {
+        ip_in_trace(buf, TRACE_DROP);
+        return;
+    }
+    // 记录ip头和地址，供上层回复icmp差错报文和计算伪头部
+    buf->l3 = buf->data;
+    memcpy(buf->src_ip, hdr->src_ip, NET_IP_LEN);
+    memcpy(buf->dst_ip, hdr->dst_ip, NET_IP_LEN);
     
     // padding，检查长度
-    if(swap16(hdr->total_len16) > buf->len) return;  
+    if(swap16(hdr->total_len16) > buf->len)
+    {
+        ip_in_trace(buf, TRACE_DROP);
+        return;
+    }
     else if(swap16(hdr->total_len16) < buf->len)
     {
         buf_remove_padding(buf, buf->len - swap16(hdr->total_len16));
@@ -49,11 +75,14 @@ void ip_in(buf_t *buf, uint8_t *src_mac)
         case(NET_PROTOCOL_UDP):
         case(NET_PROTOCOL_ICMP):
         case(NET_PROTOCOL_TCP):
+            ip_in_trace(buf, TRACE_PASS);
             buf_remove_header(buf, hdr->hdr_len * IP_HDR_LEN_PER_BYTE);
-            net_in(buf, protocol, src_ip);
+            buf->l4 = buf->data;
+            net_in(buf, protocol, buf->src_ip);
             break;
         default:
-            icmp_unreachable(buf, src_ip, ICMP_CODE_PROTOCOL_UNREACH);
+            ip_in_trace(buf, TRACE_REJECT);
+            icmp_unreachable(buf, buf->src_ip, ICMP_CODE_PROTOCOL_UNREACH);
             break;
     }
 }
@@ -76,7 +105,7 @@ void ip_fragment_out(buf_t *buf, uint8_t *ip, net_protocol_t protocol, int id, u
     hdr->hdr_len = sizeof(ip_hdr_t) / IP_HDR_LEN_PER_BYTE;
     hdr->version = IP_VERSION_4;
     hdr->tos = 0;
-    hdr->total_len16 = swap16(buf->len);
+    hdr->total_len16 = swap16(buf_chain_len(buf));
     hdr->id16 = swap16(id);
     uint16_t flags_fragment = 0;
     if (mf) flags_fragment |= IP_MORE_FRAGMENT;
@@ -89,39 +118,55 @@ void ip_fragment_out(buf_t *buf, uint8_t *ip, net_protocol_t protocol, int id, u
     hdr->hdr_checksum16 = 0;
     hdr->hdr_checksum16 = checksum16((uint16_t*)hdr, sizeof(ip_hdr_t));
 
-    printf("fragment %lu bytes sent\n", buf->len);
+    log_debug("fragment %zu bytes sent", buf_chain_len(buf));
     arp_out(buf, ip);
 }
 
 /**
  * @brief 处理一个要发送的ip数据包
+ *        需要分片时，每个分片由一个放ip头的新段加上原buf的切片组成，不拷贝负载
  * 
- * @param buf 要处理的包
+ * @param buf 要处理的包，可以是scatter-gather链
  * @param ip 目标ip地址
  * @param protocol 上层协议
  */
 void ip_out(buf_t *buf, uint8_t *ip, net_protocol_t protocol)
 {
     static int ip_id = 0;
-    printf("sending buf %lu bytes\n", buf->len);
+    size_t total_len = buf_chain_len(buf);
+    log_debug("sending buf %zu bytes", total_len);
     // 只考虑20字节的ip头时，最大数据长度是8的整数倍
     size_t max_data_len = IP_MTU - sizeof(ip_hdr_t);
 
-    // 分片
-    buf_t new_buf;
-    uint32_t offset = 0;
+    // 不需要分片时直接在原buf头部添加ip头
+    if (total_len <= max_data_len)
+    {
+        ip_fragment_out(buf, ip, protocol, ip_id, 0, 0);
+        ip_id++;
+        return;
+    }
 
-    while (buf->len > max_data_len)
+    // 分片，先持有一个引用，非池化的buf只在这里拷贝一次
+    buf_t *root = buf_get(buf);
+    if (root == NULL) return;
+    size_t offset = 0;
+    while (offset < total_len)
     {
-        buf_init(&new_buf, max_data_len);
-        memcpy(new_buf.data, buf->data, max_data_len);
-        ip_fragment_out(&new_buf, ip, protocol, ip_id, offset, 1);
-        buf_remove_header(buf, max_data_len);
-        offset += max_data_len / IP_HDR_OFFSET_PER_BYTE;
+        size_t len = min32(total_len - offset, max_data_len);
+        buf_t *frag = buf_alloc(0);
+        if (frag == NULL) break;
+        buf_t *slice = buf_slice(root, offset, len);
+        if (slice == NULL)
+        {
+            buf_put(frag);
+            break;
+        }
+        buf_chain(frag, slice);
+        ip_fragment_out(frag, ip, protocol, ip_id, offset / IP_HDR_OFFSET_PER_BYTE, offset + len < total_len);
+        buf_put(frag);
+        offset += len;
     }
-    buf_init(&new_buf, buf->len);
-    memcpy(new_buf.data, buf->data, buf->len); // 最后一个分片，大小就等于该分片大小
-    ip_fragment_out(&new_buf, ip, protocol, ip_id, offset, 0);
+    buf_put(root);
     ip_id++;
 }
 
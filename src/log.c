@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include "log.h"
+#include "net.h"
+#include "queue.h"
+
+#define LOG_FLUSH_BATCH 16 //log_flush每次从环中取出的记录数
+
+/**
+ * @brief 运行期日志级别，不超过编译期的LOG_LEVEL才有效
+ * 
+ */
+int log_level = LOG_LEVEL;
+
+/**
+ * @brief 日志环形缓冲区，任意线程写入，net_poll里统一输出
+ * 
+ */
+static mpmc_t *log_ring;
+
+/**
+ * @brief 环满时丢弃的记录数，以及上次输出时已经报告过的数量
+ * 
+ */
+static size_t log_dropped;
+static size_t log_dropped_reported;
+
+static const char *log_level_name[] = {
+    [LOG_ERROR] = "ERROR",
+    [LOG_WARN] = "WARN",
+    [LOG_INFO] = "INFO",
+    [LOG_DEBUG] = "DEBUG",
+};
+
+/**
+ * @brief 初始化日志环形缓冲区
+ * 
+ * @return int 成功为0，失败为-1
+ */
+int log_init()
+{
+    if (log_ring)
+        return 0;
+    log_ring = mpmc_init(LOG_RING_LEN, sizeof(log_record_t));
+    return log_ring ? 0 : -1;
+}
+
+/**
+ * @brief 设置运行期日志级别
+ * 
+ * @param level 输出不超过这个级别的日志
+ */
+void log_set_level(int level)
+{
+    log_level = level;
+}
+
+/**
+ * @brief 内部函数，把一条记录输出到stdout
+ * 
+ * @param record 要输出的记录
+ */
+static void log_print(const log_record_t *record)
+{
+    printf("%s.%03u %-5s %s\n", timetos(record->time / 1000), (unsigned)(record->time % 1000),
+           log_level_name[record->level], record->msg);
+}
+
+/**
+ * @brief 记录一条日志，一般通过log_debug等宏调用
+ *        只格式化到环里，不做任何I/O，环满时丢弃并计数
+ *        log_init之前没有环，直接输出
+ * 
+ * @param level 日志级别
+ * @param fmt 格式串，不需要换行
+ */
+void log_write(int level, const char *fmt, ...)
+{
+    log_record_t record;
+    va_list ap;
+    record.time = net_now();
+    record.level = level;
+    va_start(ap, fmt);
+    vsnprintf(record.msg, sizeof(record.msg), fmt, ap);
+    va_end(ap);
+
+    if (!log_ring)
+        log_print(&record);
+    else if (mpmc_push(log_ring, &record) != 0)
+        __atomic_fetch_add(&log_dropped, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief 输出环里所有的日志，在net_poll处理完数据包之后调用
+ * 
+ */
+void log_flush()
+{
+    log_record_t records[LOG_FLUSH_BATCH];
+    size_t n;
+    if (!log_ring)
+        return;
+    while ((n = mpmc_pop_batch(log_ring, records, LOG_FLUSH_BATCH)) > 0)
+        for (size_t i = 0; i < n; i++)
+            log_print(&records[i]);
+
+    size_t dropped = __atomic_load_n(&log_dropped, __ATOMIC_RELAXED);
+    if (dropped != log_dropped_reported)
+    {
+        printf("log ring full, %zu records dropped\n", dropped - log_dropped_reported);
+        log_dropped_reported = dropped;
+    }
+    fflush(stdout);
+}
@@ -4,6 +4,8 @@
 #include "http.h"
 #include "driver.h"
 #include "time.h"
+#include "trace.h"
+#include <signal.h>
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wformat="
@@ -33,6 +35,16 @@ void tcp_handler(tcp_connect_t* connect, connect_state_t state) {
 }
 #endif
 
+#if defined(NET_TRACE) && defined(SIGUSR1)
+// 收到SIGUSR1时在主循环里把跟踪环写到net.trace，用trace_decode查看
+static volatile sig_atomic_t trace_requested;
+
+static void trace_request(int sig)
+{
+    trace_requested = 1;
+}
+#endif
+
 int main(int argc, char const *argv[])
 {
 
@@ -49,6 +61,9 @@ int main(int argc, char const *argv[])
 #endif
 #ifdef HTTP
     http_server_open(62000);
+#endif
+#if defined(NET_TRACE) && defined(SIGUSR1)
+    signal(SIGUSR1, trace_request);
 #endif
     while (1) 
 	{
@@ -56,6 +71,13 @@ int main(int argc, char const *argv[])
         net_poll(); //一次主循环
 #ifdef HTTP
         http_server_run();
+#endif
+#if defined(NET_TRACE) && defined(SIGUSR1)
+        if (trace_requested)
+        {
+            trace_requested = 0;
+            trace_dump("net.trace");
+        }
 #endif
         // 节约用电
         struct timespec sleepTime = { 0, 1000000 };
@@ -1,29 +1,196 @@
 #include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
 #include "map.h"
+#include "net.h"
+#include "timer.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define MAP_CTRL_EMPTY 0x80   //空散列槽
+#define MAP_CTRL_DELETED 0xfe //已删除的散列槽
+#define MAP_ALIGN 8           //键值对的对齐长度
+#define MAP_GROUP_SIZE 16     //一次探测的散列槽数，即一组控制字节
+#define MAP_REGISTRY_MAX 16   //最多登记的map数，用于打印统计
+#define MAP_RETIRED_MAX 4     //concurrent时最多积压的旧存储区数，达到后写者等读者都离开再释放
+
+typedef struct map_timer //键值对的超时定时器，键值对整理时会移动，所以单独分配并按键查找
+{
+    net_timer_t timer; //时间轮上的定时器
+    map_t *map;        //所属的map
+    uint8_t key[];     //键值对的键
+} map_timer_t;
+
+typedef struct map_entry_hdr //键值对的头部，后面依次是值和键
+{
+    uint64_t time;      //更新时间，net_now()的毫秒数
+    map_timer_t *timer; //超时定时器，map没有超时时间时为NULL
+    uint8_t valid;      //是否有效，删除后为0
+    uint8_t referenced; //CLOCK淘汰的访问位，读取、更新和刷新时置1
+} map_entry_hdr_t;
+
+static map_t *map_registry[MAP_REGISTRY_MAX]; //用map_set_name登记的map，用于打印统计
+static size_t map_registry_count;
+
+/**
+ * @brief 内部函数，按MAP_ALIGN向上对齐
+ * 
+ * @param len 长度
+ * @return size_t 对齐后的长度
+ */
+static size_t map_align(size_t len)
+{
+    return (len + MAP_ALIGN - 1) & ~(size_t)(MAP_ALIGN - 1);
+}
+
+/**
+ * @brief 内部函数，murmur3的finalizer，打散64位整数
+ * 
+ * @param h 要打散的整数
+ * @return uint64_t 散列值
+ */
+static inline uint64_t map_mix(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/**
+ * @brief 内部函数，计算键的散列值，整数键直接打散，其他键先做FNV-1a
+ * 
+ * @param map 键所属的map
+ * @param key 键指针
+ * @return uint64_t 散列值，低7位存入控制字节，其余位决定散列槽位置
+ */
+static uint64_t map_hash(const map_t *map, const void *key)
+{
+    switch (map->key_type)
+    {
+    case MAP_KEY_U16:
+    {
+        uint16_t k;
+        memcpy(&k, key, sizeof(k));
+        return map_mix(k);
+    }
+    case MAP_KEY_U32:
+    {
+        uint32_t k;
+        memcpy(&k, key, sizeof(k));
+        return map_mix(k);
+    }
+    case MAP_KEY_U64:
+    {
+        uint64_t k;
+        memcpy(&k, key, sizeof(k));
+        return map_mix(k);
+    }
+    default:
+        break;
+    }
+    const uint8_t *p = key;
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < map->key_len; i++)
+    {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+    return map_mix(h);
+}
+
+/**
+ * @brief 内部函数，在一组控制字节中查找等于h2的，返回位图
+ * 
+ * @param ctrl 一组控制字节
+ * @param h2 要找的值
+ * @return uint32_t 第i位为1表示第i个控制字节匹配
+ */
+static inline uint32_t map_group_match(const uint8_t *ctrl, uint8_t h2)
+{
+#ifdef __SSE2__
+    __m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(h2)));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < MAP_GROUP_SIZE; i++)
+        mask |= (uint32_t)(ctrl[i] == h2) << i;
+    return mask;
+#endif
+}
+
+/**
+ * @brief 内部函数，在一组控制字节中查找可以插入的（空或已删除），即最高位为1的
+ * 
+ * @param ctrl 一组控制字节
+ * @return uint32_t 第i位为1表示第i个散列槽可用
+ */
+static inline uint32_t map_group_available(const uint8_t *ctrl)
+{
+#ifdef __SSE2__
+    return _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)ctrl));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < MAP_GROUP_SIZE; i++)
+        mask |= (uint32_t)(ctrl[i] >> 7) << i;
+    return mask;
+#endif
+}
+
+/**
+ * @brief 内部函数，最低的1所在的位
+ * 
+ * @param mask 非0的位图
+ * @return int 位置
+ */
+static inline int map_ctz(uint32_t mask)
+{
+#if defined(__GNUC__)
+    return __builtin_ctz(mask);
+#else
+    int i = 0;
+    while (!(mask & 1))
+    {
+        mask >>= 1;
+        i++;
+    }
+    return i;
+#endif
+}
 
 /**
  * @brief 初始化map
+ *        键值对按插入顺序紧密存放，另用开放寻址的散列槽索引，散列槽数为2的幂，最多使用7/8
+ *        2、4、8字节的键按整数散列和比较，其他长度逐字节处理
+ *        存储区在第一次插入时才在堆上分配，满了扩容，过于稀疏时缩小
  * 
  * @param map 要初始化的map
  * @param key_len 键的长度
  * @param value_len 值的长度
- * @param max_size 最大容量，为0则根据MAP_MAX_LEN自动设置
- * @param timeout 超时秒数，为0则永不超时
+ * @param max_size 最大容量，为0则不限制
+ * @param timeout 超时毫秒数，为0则永不超时
  * @param value_constuctor 形如memcpy的构造函数，用于拷贝值到容器中，为NULL则使用memcpy
  */
-void map_init(map_t *map, size_t key_len, size_t value_len, size_t max_size, time_t timeout, map_constuctor_t value_constuctor)
+void map_init(map_t *map, size_t key_len, size_t value_len, size_t max_size, uint64_t timeout, map_constuctor_t value_constuctor)
 {
-    if (max_size == 0 || max_size * (key_len + value_len + sizeof(time_t)) > MAP_MAX_LEN)
-        max_size = MAP_MAX_LEN / (key_len + value_len + sizeof(time_t));
+    // 键值对布局为：头部、值、键，头部和值都是对齐的
+    size_t entry_len = map_align(map_align(sizeof(map_entry_hdr_t)) + map_align(value_len) + key_len);
+    if (max_size == 0 || max_size > UINT32_MAX)
+        max_size = UINT32_MAX;
     if (value_constuctor == NULL)
         value_constuctor = (map_constuctor_t)memcpy;
 
     memset(map, 0, sizeof(map_t));
     map->key_len = key_len;
+    map->key_type = key_len == 2 ? MAP_KEY_U16 : key_len == 4 ? MAP_KEY_U32 : key_len == 8 ? MAP_KEY_U64 : MAP_KEY_BYTES;
     map->value_len = value_len;
     map->max_size = max_size;
     map->timeout = timeout;
     map->value_constuctor = value_constuctor;
+    map->entry_len = entry_len;
 }
 
 /**
@@ -38,17 +205,42 @@ size_t map_size(map_t *map)
 }
 
 /**
- * @brief 内部函数，获取第n个物理位置的键值对
+ * @brief 内部函数，获取第n个键值对
  * 
  * @param map 要获取的map
- * @param pos 位置
- * @return void* 键值对指针
+ * @param pos 下标
+ * @return uint8_t* 键值对指针
  */
-void *map_entry_get(map_t *map, size_t pos)
+static uint8_t *map_entry_get(map_t *map, size_t pos)
 {
-    if (pos >= map->max_size)
-        return NULL;
-    return map->data + pos * (map->key_len + map->value_len + sizeof(time_t));
+    return map->entries + pos * map->entry_len;
+}
+
+/**
+ * @brief 内部函数，键值对的头部
+ * 
+ */
+static map_entry_hdr_t *map_entry_hdr(uint8_t *entry)
+{
+    return (map_entry_hdr_t *)entry;
+}
+
+/**
+ * @brief 内部函数，键值对的值
+ * 
+ */
+static uint8_t *map_entry_value(uint8_t *entry)
+{
+    return entry + map_align(sizeof(map_entry_hdr_t));
+}
+
+/**
+ * @brief 内部函数，键值对的键
+ * 
+ */
+static uint8_t *map_entry_key(map_t *map, uint8_t *entry)
+{
+    return map_entry_value(entry) + map_align(map->value_len);
 }
 
 /**
@@ -58,65 +250,589 @@ void *map_entry_get(map_t *map, size_t pos)
  * @param entry 键值对指针
  * @return int 1为合法，0为不合法
  */
-int map_entry_valid(map_t *map, const void *entry)
+static int map_entry_valid(map_t *map, uint8_t *entry)
 {
-    time_t entry_time = *(time_t *)((uint8_t *)entry + map->key_len + map->value_len);
-    return entry_time && (!map->timeout || entry_time + map->timeout >= time(NULL));
+    map_entry_hdr_t *hdr = map_entry_hdr(entry);
+    return hdr->valid && (!map->timeout || hdr->time + map->timeout >= net_now());
 }
 
 /**
- * @brief 获取map中指定键的值
+ * @brief 内部函数，超时定时器的回调，删除到期的键值对
+ *        键值对更新时定时器会重新启动，所以到期时键值对一定已经超时
  * 
- * @param map 要获取的map
+ * @param arg 到期的map_timer_t
+ */
+static void map_timer_expire(void *arg)
+{
+    map_timer_t *timer = arg;
+    map_delete(timer->map, timer->key);
+}
+
+/**
+ * @brief 内部函数，按键值对的更新时间（重新）启动其超时定时器
+ * 
+ * @param map 所属的map
+ * @param entry 键值对指针
+ */
+static void map_entry_arm(map_t *map, uint8_t *entry)
+{
+    map_entry_hdr_t *hdr = map_entry_hdr(entry);
+    if (!map->timeout)
+        return;
+    if (hdr->timer == NULL)
+    {
+        hdr->timer = malloc(sizeof(map_timer_t) + map->key_len);
+        if (hdr->timer == NULL)
+            return; // 没有定时器时仍然会在访问时发现超时
+        memset(&hdr->timer->timer, 0, sizeof(net_timer_t));
+        hdr->timer->map = map;
+        memcpy(hdr->timer->key, map_entry_key(map, entry), map->key_len);
+    }
+    timer_add(&hdr->timer->timer, hdr->time + map->timeout + 1, map_timer_expire, hdr->timer);
+}
+
+/**
+ * @brief 内部函数，释放键值对：调用值的析构函数，释放超时定时器，标记为无效
+ * 
+ * @param map 所属的map
+ * @param entry 键值对指针
+ */
+static void map_entry_release(map_t *map, uint8_t *entry)
+{
+    map_entry_hdr_t *hdr = map_entry_hdr(entry);
+    if (hdr->timer)
+    {
+        timer_cancel(&hdr->timer->timer);
+        free(hdr->timer);
+        hdr->timer = NULL;
+    }
+    hdr->valid = 0;
+    if (map->value_destructor)
+        map->value_destructor(map_entry_value(entry));
+}
+
+/**
+ * @brief 生成键的比较函数，按type整数比较
+ * 
+ */
+#define MAP_DEFINE_KEY_EQUAL(name, type)                              \
+    static inline int name(const void *a, const void *b, size_t len) \
+    {                                                                 \
+        type x, y;                                                    \
+        memcpy(&x, a, sizeof(type));                                  \
+        memcpy(&y, b, sizeof(type));                                  \
+        return x == y;                                                \
+    }
+
+MAP_DEFINE_KEY_EQUAL(map_key_equal_u16, uint16_t)
+MAP_DEFINE_KEY_EQUAL(map_key_equal_u32, uint32_t)
+MAP_DEFINE_KEY_EQUAL(map_key_equal_u64, uint64_t)
+
+static inline int map_key_equal_bytes(const void *a, const void *b, size_t len)
+{
+    return !memcmp(a, b, len);
+}
+
+/**
+ * @brief 内部函数，记录一次查找探测的组数
+ * 
+ * @param map 要记录的map
+ * @param probes 探测的组数
+ */
+static inline void map_probe_record(map_t *map, size_t probes)
+{
+    map->stats.finds++;
+    map->stats.probes += probes;
+    if (probes > map->stats.max_probes)
+        map->stats.max_probes = probes;
+}
+
+/**
+ * @brief 生成按键查找散列槽的函数，每次用控制字节比较一组散列槽，只对控制字节匹配的比较键
+ *        遇到含空散列槽的组时停止
+ * 
+ */
+#define MAP_DEFINE_FIND_SLOT(name, key_equal)                                                   \
+    static size_t name(map_t *map, const void *key, uint64_t hash)                              \
+    {                                                                                           \
+        uint8_t h2 = hash & 0x7f;                                                               \
+        size_t group_mask = map->slot_mask / MAP_GROUP_SIZE;                                    \
+        size_t probes = 1;                                                                      \
+        for (size_t group = (hash >> 7) & group_mask;; group = (group + 1) & group_mask, probes++) \
+        {                                                                                       \
+            const uint8_t *ctrl = map->ctrl + group * MAP_GROUP_SIZE;                           \
+            for (uint32_t match = map_group_match(ctrl, h2); match; match &= match - 1)        \
+            {                                                                                   \
+                size_t pos = group * MAP_GROUP_SIZE + map_ctz(match);                           \
+                if (key_equal(key, map_entry_key(map, map_entry_get(map, map->slots[pos])), map->key_len)) \
+                {                                                                               \
+                    map_probe_record(map, probes);                                              \
+                    return pos;                                                                 \
+                }                                                                               \
+            }                                                                                   \
+            if (map_group_match(ctrl, MAP_CTRL_EMPTY))                                          \
+            {                                                                                   \
+                map_probe_record(map, probes);                                                  \
+                return SIZE_MAX;                                                                \
+            }                                                                                   \
+        }                                                                                       \
+    }
+
+MAP_DEFINE_FIND_SLOT(map_find_slot_u16, map_key_equal_u16)
+MAP_DEFINE_FIND_SLOT(map_find_slot_u32, map_key_equal_u32)
+MAP_DEFINE_FIND_SLOT(map_find_slot_u64, map_key_equal_u64)
+MAP_DEFINE_FIND_SLOT(map_find_slot_bytes, map_key_equal_bytes)
+
+/**
+ * @brief 内部函数，查找键所在的散列槽
+ * 
+ * @param map 要查找的map
  * @param key 键指针
- * @return void* 值指针，找不到为NULL 
+ * @param hash 键的散列值
+ * @return size_t 散列槽位置，找不到为SIZE_MAX
  */
-void *map_get(map_t *map, const void *key)
+static size_t map_find_slot(map_t *map, const void *key, uint64_t hash)
+{
+    if (map->entry_cap == 0)
+        return SIZE_MAX;
+    switch (map->key_type)
+    {
+    case MAP_KEY_U16:
+        return map_find_slot_u16(map, key, hash);
+    case MAP_KEY_U32:
+        return map_find_slot_u32(map, key, hash);
+    case MAP_KEY_U64:
+        return map_find_slot_u64(map, key, hash);
+    default:
+        return map_find_slot_bytes(map, key, hash);
+    }
+}
+
+/**
+ * @brief 内部函数，删除散列槽中的键值对，只留下墓碑，整理时才回收
+ * 
+ * @param map 要操作的map
+ * @param pos 散列槽位置
+ */
+static void map_erase_slot(map_t *map, size_t pos)
+{
+    map->ctrl[pos] = MAP_CTRL_DELETED;
+    map->size--;
+    map_entry_release(map, map_entry_get(map, map->slots[pos]));
+}
+
+/**
+ * @brief 内部函数，把键值对登记到散列槽中
+ * 
+ * @param map 要操作的map
+ * @param hash 键的散列值
+ * @param index 键值对下标
+ */
+static void map_insert_slot(map_t *map, uint64_t hash, size_t index)
+{
+    size_t group_mask = map->slot_mask / MAP_GROUP_SIZE;
+    size_t group = (hash >> 7) & group_mask;
+    uint32_t available;
+    while (!(available = map_group_available(map->ctrl + group * MAP_GROUP_SIZE)))
+        group = (group + 1) & group_mask;
+    size_t pos = group * MAP_GROUP_SIZE + map_ctz(available);
+    map->ctrl[pos] = hash & 0x7f;
+    map->slots[pos] = index;
+}
+
+/**
+ * @brief 内部函数，concurrent的map获取写锁，写者之间互斥，读者不受影响
+ * 
+ * @param map 要操作的map
+ */
+static void map_write_lock(map_t *map)
+{
+    if (!map->concurrent)
+        return;
+    while (__atomic_test_and_set(&map->write_lock, __ATOMIC_ACQUIRE))
+        ;
+}
+
+/**
+ * @brief 内部函数，释放写锁
+ * 
+ * @param map 要操作的map
+ */
+static void map_write_unlock(map_t *map)
+{
+    if (map->concurrent)
+        __atomic_clear(&map->write_lock, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief 内部函数，开始修改，顺序锁的序号变为奇数，正在读的读者会重试。需要持有写锁
+ * 
+ * @param map 要操作的map
+ */
+static void map_seq_begin(map_t *map)
+{
+    if (!map->concurrent)
+        return;
+    __atomic_store_n(&map->seq, map->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/**
+ * @brief 内部函数，释放退役的旧存储区。需要持有写锁，且顺序锁的序号为偶数，
+ *        否则读者会在奇数序号上空转而一直不离开
+ *        新存储区发布后再看到没有读者，说明之后进来的读者只会拿到新存储区
+ * 
+ * @param map 要操作的map
+ * @param wait 有读者时是否等待，为0时留到下次写操作再试
+ */
+static void map_reclaim(map_t *map, int wait)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&map->readers, __ATOMIC_ACQUIRE))
+    {
+        if (!wait)
+            return;
+    }
+    while (map->retired)
+    {
+        void *retired = map->retired;
+        map->retired = *(void **)retired;
+        free(retired);
+    }
+    map->retired_count = 0;
+}
+
+/**
+ * @brief 内部函数，结束修改，顺序锁的序号变回偶数，并尝试释放退役的存储区
+ * 
+ * @param map 要操作的map
+ */
+static void map_seq_end(map_t *map)
+{
+    if (!map->concurrent)
+        return;
+    __atomic_store_n(&map->seq, map->seq + 1, __ATOMIC_RELEASE);
+    if (map->retired)
+        map_reclaim(map, map->retired_count >= MAP_RETIRED_MAX);
+}
+
+/**
+ * @brief 内部函数，按新的散列槽数重新分配存储区，去掉已删除和已超时的键值对并重建散列槽，保持插入顺序
+ *        新的容量必须能放下所有有效的键值对
+ * 
+ * @param map 要操作的map
+ * @param slot_num 新的散列槽数，2的幂且不小于MAP_GROUP_SIZE
+ * @return int 成功为0，失败为-1，此时map不变
+ */
+static int map_rehash(map_t *map, size_t slot_num)
+{
+    size_t entry_cap = slot_num / 8 * 7;
+    uint8_t *storage = malloc(entry_cap * map->entry_len + slot_num * (sizeof(uint32_t) + 1));
+    if (storage == NULL)
+        return -1;
+    map->stats.rehashes++;
+    uint8_t *old_entries = map->entries;
+    size_t old_count = map->entry_count;
+    map->entries = storage;
+    map->slots = (uint32_t *)(storage + entry_cap * map->entry_len);
+    map->ctrl = (uint8_t *)(map->slots + slot_num);
+    map->slot_mask = slot_num - 1;
+    map->entry_cap = entry_cap;
+    memset(map->ctrl, MAP_CTRL_EMPTY, slot_num);
+
+    size_t count = 0, clock_hand = SIZE_MAX;
+    for (size_t i = 0; i < old_count; i++)
+    {
+        uint8_t *entry = old_entries + i * map->entry_len;
+        // CLOCK指针跟着键值对移动，避免每次整理后从头扫
+        if (i == map->clock_hand)
+            clock_hand = count;
+        if (!map_entry_valid(map, entry))
+        {
+            if (map_entry_hdr(entry)->valid)
+            {
+                map->size--;
+                map_entry_release(map, entry);
+            }
+            continue;
+        }
+        memcpy(map_entry_get(map, count), entry, map->entry_len);
+        map_insert_slot(map, map_hash(map, map_entry_key(map, entry)), count);
+        count++;
+    }
+    map->entry_count = count;
+    map->clock_hand = clock_hand == SIZE_MAX ? 0 : clock_hand;
+    if (map->concurrent && old_entries)
+    {
+        // 读者可能还在读旧存储区，挂到退役链表上，map_seq_end时没有读者了再释放
+        *(void **)old_entries = map->retired;
+        map->retired = old_entries;
+        map->retired_count++;
+    }
+    else
+        free(old_entries);
+    return 0;
+}
+
+/**
+ * @brief 内部函数，按CLOCK算法淘汰一个键值对：从指针处开始转，访问位为1的清零并跳过，
+ *        遇到访问位为0或已超时的就删除，最多转两圈
+ * 
+ * @param map 要操作的map
+ * @return int 成功为0，没有可淘汰的为-1
+ */
+static int map_evict(map_t *map)
+{
+    for (size_t n = 0; n < map->entry_count * 2; n++)
+    {
+        if (map->clock_hand >= map->entry_count)
+            map->clock_hand = 0;
+        uint8_t *entry = map_entry_get(map, map->clock_hand++);
+        map_entry_hdr_t *hdr = map_entry_hdr(entry);
+        if (!hdr->valid)
+            continue;
+        if (hdr->referenced && map_entry_valid(map, entry))
+        {
+            hdr->referenced = 0;
+            continue;
+        }
+        void *key = map_entry_key(map, entry);
+        map_erase_slot(map, map_find_slot(map, key, map_hash(map, key)));
+        map->stats.evictions++;
+        return 0;
+    }
+    return -1;
+}
+
+/**
+ * @brief 内部函数，有效的键值对不足容量的1/8时缩小存储区，批量删除后一次缩到位，遍历期间不缩小
+ * 
+ * @param map 要操作的map
+ */
+static void map_shrink(map_t *map)
+{
+    // concurrent的map不缩小，每次重新分配都会留下一块要等读者离开才能释放的旧存储区
+    if (map->iterators || map->concurrent)
+        return;
+    size_t slot_num = map->slot_mask + 1;
+    while (slot_num > MAP_GROUP_SIZE && map->size < slot_num / 8 * 7 / 8)
+        slot_num /= 2;
+    if (slot_num != map->slot_mask + 1)
+        map_rehash(map, slot_num);
+}
+
+/**
+ * @brief 内部函数，map_get的实现，调用者持有写锁
+ */
+static void *map_get_locked(map_t *map, const void *key)
 {
     if (key == NULL)
         return NULL;
-    for (size_t i = 0; i < map->max_size; i++)
+    map->stats.lookups++;
+    size_t pos = map_find_slot(map, key, map_hash(map, key));
+    if (pos == SIZE_MAX)
     {
-        uint8_t *entry = map_entry_get(map, i);
-        if (map_entry_valid(map, entry) && !memcmp(key, entry, map->key_len))
-            return entry + map->key_len;
+        map->stats.misses++;
+        return NULL;
+    }
+    uint8_t *entry = map_entry_get(map, map->slots[pos]);
+    if (!map_entry_valid(map, entry))
+    {
+        // 已超时，顺便删除
+        map_seq_begin(map);
+        map_erase_slot(map, pos);
+        map_seq_end(map);
+        map->stats.misses++;
+        map->stats.expired++;
+        return NULL;
     }
-    return NULL;
+    map->stats.hits++;
+    map_entry_hdr(entry)->referenced = 1;
+    return map_entry_value(entry);
 }
 
 /**
- * @brief 插入或更新map中指定键的值
+ * @brief 获取map中指定键的值
  * 
- * @param map 要操作的map
+ * @param map 要获取的map
  * @param key 键指针
- * @param value 值指针
- * @return int 成功为0，失败为-1
-*/
-int map_set(map_t *map, const void *key, const void *value)
+ * @return void* 值指针，找不到为NULL 
+ */
+void *map_get(map_t *map, const void *key)
+{
+    map_write_lock(map);
+    void *value = map_get_locked(map, key);
+    map_write_unlock(map);
+    return value;
+}
+
+/**
+ * @brief 把map中指定键的值拷贝出来。map_set_concurrent后可以在其他线程调用，不加锁：
+ *        按顺序锁读取，读取期间有写者修改则重试；读取期间登记为读者，旧存储区等读者都离开后才释放
+ *        无锁读取不删除已超时的键值对，也不计入统计；不是concurrent时等同于map_get再拷贝
+ * 
+ * @param map 要读取的map
+ * @param key 键指针
+ * @param value 值拷贝到这里，长度为value_len
+ * @return int 找到为0，找不到或已超时为-1
+ */
+int map_read(map_t *map, const void *key, void *value)
 {
-    uint8_t *old_value = map_get(map, key);
-    if (old_value)
+    if (!map->concurrent)
     {
-        map->value_constuctor(old_value, value, map->value_len);
-        *(time_t *)(old_value + map->value_len) = time(NULL);
+        void *found = map_get(map, key);
+        if (found == NULL)
+            return -1;
+        memcpy(value, found, map->value_len);
         return 0;
     }
-    if (map->size == map->max_size)
-        return -1;
-    for (size_t i = 0; i < map->max_size; i++)
+    uint64_t hash = map_hash(map, key);
+    uint8_t h2 = hash & 0x7f;
+    // 登记为读者，写者看到读者数为0之前不会释放旧存储区
+    __atomic_add_fetch(&map->readers, 1, __ATOMIC_SEQ_CST);
+    for (;;)
     {
-        uint8_t *entry = map_entry_get(map, i);
-        if (!map_entry_valid(map, entry))
+        uint32_t seq = __atomic_load_n(&map->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1)
+            continue;
+        // 先取得一致的存储区快照，之后即使被替换也仍然可读
+        uint8_t *entries = __atomic_load_n(&map->entries, __ATOMIC_RELAXED);
+        uint32_t *slots = __atomic_load_n(&map->slots, __ATOMIC_RELAXED);
+        uint8_t *ctrl = __atomic_load_n(&map->ctrl, __ATOMIC_RELAXED);
+        size_t slot_mask = __atomic_load_n(&map->slot_mask, __ATOMIC_RELAXED);
+        size_t entry_cap = __atomic_load_n(&map->entry_cap, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&map->seq, __ATOMIC_RELAXED) != seq)
+            continue;
+
+        int ret = -1;
+        size_t group_mask = slot_mask / MAP_GROUP_SIZE;
+        size_t group = (hash >> 7) & group_mask;
+        // 数据可能正被修改，探测组数和下标都要限制在快照的范围内
+        for (size_t n = 0; entry_cap && n <= group_mask && ret; n++, group = (group + 1) & group_mask)
+        {
+            const uint8_t *group_ctrl = ctrl + group * MAP_GROUP_SIZE;
+            for (uint32_t match = map_group_match(group_ctrl, h2); match; match &= match - 1)
+            {
+                uint32_t index = slots[group * MAP_GROUP_SIZE + map_ctz(match)];
+                if (index >= entry_cap)
+                    continue;
+                uint8_t *entry = entries + index * map->entry_len;
+                if (memcmp(map_entry_key(map, entry), key, map->key_len) != 0)
+                    continue;
+                map_entry_hdr_t *hdr = map_entry_hdr(entry);
+                if (hdr->valid && (!map->timeout || hdr->time + map->timeout >= net_now()))
+                {
+                    memcpy(value, map_entry_value(entry), map->value_len);
+                    __atomic_store_n(&hdr->referenced, 1, __ATOMIC_RELAXED);
+                    ret = 0;
+                }
+                break;
+            }
+            if (map_group_match(group_ctrl, MAP_CTRL_EMPTY))
+                break;
+        }
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&map->seq, __ATOMIC_RELAXED) == seq)
+        {
+            __atomic_sub_fetch(&map->readers, 1, __ATOMIC_RELEASE);
+            return ret;
+        }
+    }
+}
+
+/**
+ * @brief 内部函数，map_set的实现，调用者持有写锁
+ */
+static int map_set_locked(map_t *map, const void *key, const void *value)
+{
+    uint64_t hash = map_hash(map, key);
+    size_t pos = map_find_slot(map, key, hash);
+    if (pos != SIZE_MAX)
+    {
+        uint8_t *entry = map_entry_get(map, map->slots[pos]);
+        if (map_entry_valid(map, entry))
         {
-            memcpy(entry, key, map->key_len);
-            map->value_constuctor(entry + map->key_len, value, map->value_len);
-            *(time_t *)(entry + map->key_len + map->value_len) = time(NULL);
-            map->size++;
+            if (map->value_destructor)
+                map->value_destructor(map_entry_value(entry));
+            map->value_constuctor(map_entry_value(entry), value, map->value_len);
+            map_entry_hdr(entry)->time = net_now();
+            map_entry_hdr(entry)->referenced = 1;
+            map_entry_arm(map, entry);
             return 0;
         }
+        map_erase_slot(map, pos);
+    }
+    if (map->size >= map->max_size && map->evict == MAP_EVICT_CLOCK)
+        map_evict(map);
+    if (map->entry_count == map->entry_cap)
+    {
+        // 遍历期间不能移动键值对
+        if (map->iterators)
+        {
+            map->stats.insert_fails++;
+            return -1;
+        }
+        // 键值对数组满了，有效的超过一半时扩容，否则按原大小去掉墓碑
+        size_t slot_num = map->entry_cap ? map->slot_mask + 1 : MAP_GROUP_SIZE;
+        if (map->entry_cap && map->size >= map->entry_cap / 2)
+            slot_num *= 2;
+        if (map_rehash(map, slot_num) != 0)
+        {
+            map->stats.insert_fails++;
+            return -1;
+        }
+    }
+    if (map->size >= map->max_size)
+    {
+        map->stats.insert_fails++;
+        return -1;
     }
 
-    return -1;
+    uint8_t *entry = map_entry_get(map, map->entry_count);
+    memcpy(map_entry_key(map, entry), key, map->key_len);
+    map->value_constuctor(map_entry_value(entry), value, map->value_len);
+    map_entry_hdr(entry)->time = net_now();
+    map_entry_hdr(entry)->timer = NULL;
+    map_entry_hdr(entry)->valid = 1;
+    map_entry_hdr(entry)->referenced = 0;
+    map_entry_arm(map, entry);
+    map_insert_slot(map, hash, map->entry_count);
+    map->entry_count++;
+    map->size++;
+    map->stats.inserts++;
+    return 0;
+}
+
+/**
+ * @brief 插入或更新map中指定键的值
+ * 
+ * @param map 要操作的map
+ * @param key 键指针
+ * @param value 值指针
+ * @return int 成功为0，失败为-1
+*/
+int map_set(map_t *map, const void *key, const void *value)
+{
+    map_write_lock(map);
+    map_seq_begin(map);
+    int ret = map_set_locked(map, key, value);
+    map_seq_end(map);
+    map_write_unlock(map);
+    return ret;
+}
+
+/**
+ * @brief 内部函数，map_delete的实现，调用者持有写锁
+ */
+static void map_delete_locked(map_t *map, const void *key)
+{
+    size_t pos = map_find_slot(map, key, map_hash(map, key));
+    if (pos == SIZE_MAX)
+        return;
+    map_erase_slot(map, pos);
+    map_shrink(map);
 }
 
 /**
@@ -127,26 +843,283 @@ int map_set(map_t *map, const void *key, const void *value)
  */
 void map_delete(map_t *map, const void *key)
 {
-    uint8_t *value = map_get(map, key);
-    if (value)
+    map_write_lock(map);
+    map_seq_begin(map);
+    map_delete_locked(map, key);
+    map_seq_end(map);
+    map_write_unlock(map);
+}
+
+/**
+ * @brief 内部函数，map_touch的实现，调用者持有写锁
+ */
+static int map_touch_locked(map_t *map, const void *key)
+{
+    size_t pos = map_find_slot(map, key, map_hash(map, key));
+    if (pos == SIZE_MAX)
+        return -1;
+    uint8_t *entry = map_entry_get(map, map->slots[pos]);
+    if (!map_entry_valid(map, entry))
     {
-        *(time_t *)(value + map->value_len) = 0;
-        map->size--;
+        map_erase_slot(map, pos);
+        return -1;
     }
+    map_entry_hdr(entry)->time = net_now();
+    map_entry_hdr(entry)->referenced = 1;
+    map_entry_arm(map, entry);
+    return 0;
+}
+
+/**
+ * @brief 刷新map中指定键的更新时间，重新开始超时计时
+ * 
+ * @param map 要操作的map
+ * @param key 键指针
+ * @return int 成功为0，键不存在或已超时为-1
+ */
+int map_touch(map_t *map, const void *key)
+{
+    map_write_lock(map);
+    map_seq_begin(map);
+    int ret = map_touch_locked(map, key);
+    map_seq_end(map);
+    map_write_unlock(map);
+    return ret;
+}
+
+/**
+ * @brief 设置值的析构函数，键值对被删除、超时、覆盖或淘汰时对旧值调用
+ * 
+ * @param map 要设置的map
+ * @param value_destructor 析构函数，为NULL则不调用
+ */
+void map_set_destructor(map_t *map, map_destructor_t value_destructor)
+{
+    map->value_destructor = value_destructor;
+}
+
+/**
+ * @brief 设置满了以后的处理方式，默认插入失败
+ *        MAP_EVICT_CLOCK时新插入的键值对访问位为0，被map_get、更新或刷新后置1，
+ *        满了先淘汰没有再访问过的，使常用的键值对留在表中
+ * 
+ * @param map 要设置的map
+ * @param evict 处理方式
+ */
+void map_set_evict(map_t *map, map_evict_t evict)
+{
+    map->evict = evict;
+}
+
+/**
+ * @brief 允许其他线程用map_read无锁读取，应在map_init之后、多线程使用之前调用
+ *        之后其他接口都是写者，会互斥执行并使正在读的读者重试；被替换的存储区等读者都离开后再释放，不会缩小
+ *        遍历和map_foreach仍然不能和其他写者同时进行
+ * 
+ * @param map 要设置的map
+ */
+void map_set_concurrent(map_t *map)
+{
+    map->concurrent = 1;
+}
+
+/**
+ * @brief 销毁map，对所有未删除的值调用析构函数并释放存储区，之后map为空，可以继续使用
+ *        concurrent的map必须在没有读者时调用
+ * 
+ * @param map 要销毁的map
+ */
+void map_destroy(map_t *map)
+{
+    map_write_lock(map);
+    map_seq_begin(map);
+    for (size_t i = 0; i < map->entry_count; i++)
+    {
+        uint8_t *entry = map_entry_get(map, i);
+        if (map_entry_hdr(entry)->valid)
+            map_entry_release(map, entry);
+    }
+    free(map->entries);
+    map->entries = NULL;
+    map->slots = NULL;
+    map->ctrl = NULL;
+    map->size = 0;
+    map->entry_count = 0;
+    map->entry_cap = 0;
+    map->slot_mask = 0;
+    map_seq_end(map);
+    if (map->retired)
+        map_reclaim(map, 1);
+    map_write_unlock(map);
+}
+
+/**
+ * @brief 设置map的名字并登记，登记过的map可以用map_stats_print_all一起打印统计
+ *        应在map_init之后调用，重复登记同一个map只更新名字
+ * 
+ * @param map 要设置的map
+ * @param name 名字，需要一直有效，一般是字符串常量
+ */
+void map_set_name(map_t *map, const char *name)
+{
+    map->name = name;
+    for (size_t i = 0; i < map_registry_count; i++)
+        if (map_registry[i] == map)
+            return;
+    if (map_registry_count < MAP_REGISTRY_MAX)
+        map_registry[map_registry_count++] = map;
+}
+
+/**
+ * @brief 打印map的统计计数和占用情况
+ * 
+ * @param map 要打印的map
+ */
+void map_stats_print(map_t *map)
+{
+    map_stats_t *stats = &map->stats;
+    size_t slot_num = map->entry_cap ? map->slot_mask + 1 : 0;
+    printf("%s: size %zu/%zu slots %zu tombstones %zu | lookups %llu hits %llu misses %llu expired %llu | "
+           "probes avg %.2f max %llu | inserts %llu fails %llu evictions %llu rehashes %llu\n",
+           map->name ? map->name : "map", map->size, map->entry_cap, slot_num, map->entry_count - map->size,
+           (unsigned long long)stats->lookups, (unsigned long long)stats->hits,
+           (unsigned long long)stats->misses, (unsigned long long)stats->expired,
+           stats->finds ? (double)stats->probes / stats->finds : 0.0, (unsigned long long)stats->max_probes,
+           (unsigned long long)stats->inserts, (unsigned long long)stats->insert_fails,
+           (unsigned long long)stats->evictions, (unsigned long long)stats->rehashes);
 }
 
 /**
- * @brief 遍历map
+ * @brief 打印所有用map_set_name登记过的map的统计
+ * 
+ */
+void map_stats_print_all()
+{
+    for (size_t i = 0; i < map_registry_count; i++)
+        map_stats_print(map_registry[i]);
+}
+
+/**
+ * @brief 遍历map，按插入顺序
  * 
  * @param map 要遍历的map
  * @param handler 对每个键值对应用的回调函数，参数为（键指针，值指针，更新时间指针）
  */
 void map_foreach(map_t *map, map_entry_handler_t handler)
 {
-    for (size_t i = 0; i < map->max_size; i++)
+    for (size_t i = 0; i < map->entry_count; i++)
     {
         uint8_t *entry = map_entry_get(map, i);
         if (map_entry_valid(map, entry))
-            handler(entry, entry + map->key_len, (time_t *)(entry + map->key_len + map->value_len));
+            handler(map_entry_key(map, entry), map_entry_value(entry), &map_entry_hdr(entry)->time);
+    }
+}
+
+/**
+ * @brief 开始遍历map，按插入顺序。遍历期间可以删除任意键值对和更新已有的键，
+ *        但不会重新分配存储区，因此插入新键可能因存储区满而失败
+ *        map_iter_next返回0时遍历自动结束，提前退出时必须调用map_iter_end
+ * 
+ * @param map 要遍历的map
+ * @param iter 游标
+ */
+void map_iter_begin(map_t *map, map_iter_t *iter)
+{
+    iter->map = map;
+    iter->index = 0;
+    iter->key = NULL;
+    iter->value = NULL;
+    iter->timestamp = NULL;
+    map->iterators++;
+}
+
+/**
+ * @brief 移动到下一个未删除且未超时的键值对，结果放在iter的key、value、timestamp中
+ * 
+ * @param iter 游标
+ * @return int 有下一个键值对为1，遍历结束为0
+ */
+int map_iter_next(map_iter_t *iter)
+{
+    map_t *map = iter->map;
+    if (map == NULL)
+        return 0;
+    while (iter->index < map->entry_count)
+    {
+        uint8_t *entry = map_entry_get(map, iter->index++);
+        if (map_entry_valid(map, entry))
+        {
+            iter->key = map_entry_key(map, entry);
+            iter->value = map_entry_value(entry);
+            iter->timestamp = &map_entry_hdr(entry)->time;
+            return 1;
+        }
+    }
+    map_iter_end(iter);
+    return 0;
+}
+
+/**
+ * @brief 删除游标当前的键值对，会调用值的析构函数，之后可以继续map_iter_next
+ * 
+ * @param iter 游标
+ */
+void map_iter_delete(map_iter_t *iter)
+{
+    map_t *map = iter->map;
+    if (map == NULL || iter->key == NULL)
+        return;
+    map_write_lock(map);
+    map_seq_begin(map);
+    size_t pos = map_find_slot(map, iter->key, map_hash(map, iter->key));
+    if (pos != SIZE_MAX)
+        map_erase_slot(map, pos);
+    map_seq_end(map);
+    map_write_unlock(map);
+    iter->key = NULL;
+    iter->value = NULL;
+    iter->timestamp = NULL;
+}
+
+/**
+ * @brief 结束遍历，遍历期间推迟的缩小在这里进行。可以重复调用
+ * 
+ * @param iter 游标
+ */
+void map_iter_end(map_iter_t *iter)
+{
+    map_t *map = iter->map;
+    if (map == NULL)
+        return;
+    iter->map = NULL;
+    map_write_lock(map);
+    map_seq_begin(map);
+    map->iterators--;
+    map_shrink(map);
+    map_seq_end(map);
+    map_write_unlock(map);
+}
+
+/**
+ * @brief 一次遍历删除所有满足条件的键值对，会调用值的析构函数
+ * 
+ * @param map 要操作的map
+ * @param predicate 判断函数，参数为（键指针，值指针，arg），返回非0则删除
+ * @param arg 传给判断函数的参数
+ * @return size_t 删除的键值对数
+ */
+size_t map_delete_if(map_t *map, map_predicate_t predicate, void *arg)
+{
+    size_t count = 0;
+    map_iter_t iter;
+    map_iter_begin(map, &iter);
+    while (map_iter_next(&iter))
+    {
+        if (predicate(iter.key, iter.value, arg))
+        {
+            map_iter_delete(&iter);
+            count++;
+        }
     }
+    return count;
 }
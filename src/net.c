@@ -6,6 +6,8 @@
 #include "icmp.h"
 #include "udp.h"
 #include "tcp.h"
+#include "timer.h"
+#include "log.h"
 
 /**
  * @brief 协议表 <协议号,处理程序>的容器
@@ -26,10 +28,31 @@ uint8_t net_if_mac[NET_MAC_LEN] = NET_IF_MAC;
 uint8_t net_if_ip[NET_IP_LEN] = NET_IF_IP;
 
 /**
- * @brief 网卡接收和发送缓冲区
+ * @brief 协议栈时钟，自纪元起的毫秒数，每轮net_poll刷新一次
  * 
  */
-buf_t rxbuf, txbuf; //一个buf足够单线程使用
+static uint64_t net_clock;
+
+/**
+ * @brief 内部函数，刷新协议栈时钟
+ * 
+ */
+static void net_clock_update()
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    net_clock = (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief 获取协议栈时钟，本轮net_poll开始时的时间，避免每次比较超时都读取系统时间
+ * 
+ * @return uint64_t 自纪元起的毫秒数
+ */
+uint64_t net_now()
+{
+    return net_clock;
+}
 
 /**
  * @brief 初始化协议栈
@@ -37,7 +60,12 @@ buf_t rxbuf, txbuf; //一个buf足够单线程使用
  */
 int net_init()
 {
+    net_clock_update();
+    if (log_init() == -1)
+        return -1;
+    timer_init(net_now());
     map_init(&net_table, sizeof(uint16_t), sizeof(net_handler_t), 0, 0, NULL);
+    map_set_name(&net_table, "net_table");
     if (driver_open() == -1)
         return -1;
 #ifdef ETHERNET
@@ -97,7 +125,10 @@ int net_in(buf_t *buf, uint16_t protocol, uint8_t *src)
  */
 void net_poll()
 {
+    net_clock_update();
+    timer_poll(net_now());
 #ifdef ETHERNET
     ethernet_poll();
 #endif
+    log_flush();
 }
\ No newline at end of file
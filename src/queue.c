@@ -2,15 +2,25 @@
 #include <stdlib.h>
 #include <string.h>
 
-/// @brief 指针队列，FIFO，别忘了destroy
-/// @return queue 队列指针
+/// @brief 指针队列，FIFO，满了容量翻倍，别忘了destroy
+/// @return queue 队列指针，内存不足为NULL
 queue_t* queue_init(size_t item_size, queue_constuctor_t value_constuctor)
 {
     queue_t* queue = (queue_t*)malloc(sizeof(queue_t));
-    queue->data = (void**)malloc(QUEUE_INIT_LEN*item_size);
+    if (queue == NULL) return NULL;
+    queue->data = (uint8_t*)malloc(QUEUE_INIT_LEN*item_size);
+    if (queue->data == NULL)
+    {
+        free(queue);
+        return NULL;
+    }
     queue->head = 0;
     queue->tail = 0;
     queue->item_size = item_size;
+    queue->capacity = QUEUE_INIT_LEN;
+    queue->max_len = 0;
+    queue->high_water = 0;
+    queue->dropped = 0;
     if (value_constuctor == NULL)
     {
         value_constuctor = (queue_constuctor_t)memcpy;
@@ -18,25 +28,65 @@ queue_t* queue_init(size_t item_size, queue_constuctor_t value_constuctor)
     queue->value_constuctor = value_constuctor;
     return queue;
 }
+
+/// @brief 设置最大长度，达到后追加失败并计入dropped
+/// @param max_len 最大长度，0为不限制
+void queue_set_max_len(queue_t *queue, size_t max_len)
+{
+    queue->max_len = max_len;
+}
+
+/// @brief 队列中的元素个数
+size_t queue_len(queue_t *queue)
+{
+    return queue->tail - queue->head;
+}
+
+/// @brief 内部函数，容量翻倍，元素按顺序搬到新存储区的开头
+/// @return 成功为0，内存不足为-1
+static int queue_grow(queue_t *queue)
+{
+    size_t len = queue_len(queue);
+    uint8_t *data = (uint8_t*)malloc(queue->capacity * 2 * queue->item_size);
+    if (data == NULL) return -1;
+    size_t head = queue->head & (queue->capacity - 1);
+    size_t first = queue->capacity - head < len ? queue->capacity - head : len;
+    memcpy(data, queue->data + head * queue->item_size, first * queue->item_size);
+    memcpy(data + first * queue->item_size, queue->data, (len - first) * queue->item_size);
+    free(queue->data);
+    queue->data = data;
+    queue->capacity *= 2;
+    queue->head = 0;
+    queue->tail = len;
+    return 0;
+}
+
 int queue_append(queue_t *queue, void* item)
 {
-    if (((queue->tail + 1) % QUEUE_INIT_LEN) == queue->head) return -1;
-    void * item_loc = queue->data + queue->item_size * queue->tail;
+    size_t len = queue_len(queue);
+    if ((queue->max_len && len >= queue->max_len) ||
+        (len == queue->capacity && queue_grow(queue) != 0))
+    {
+        queue->dropped++;
+        return -1;
+    }
+    void * item_loc = queue->data + queue->item_size * (queue->tail & (queue->capacity - 1));
     queue->value_constuctor(item_loc, item, queue->item_size);
-    queue->tail = (queue->tail + 1) % QUEUE_INIT_LEN;
+    queue->tail++;
+    if (len + 1 > queue->high_water) queue->high_water = len + 1;
     return 0;
 }
 
 int queue_get(queue_t *queue, void* dst)
 {
     if (queue_peek(queue,dst) != 0) return -1;
-    queue->head = (queue->head + 1) % QUEUE_INIT_LEN;
+    queue->head++;
     return 0;
 }
 int queue_peek(queue_t *queue, void* dst)
 {
     if (queue->head == queue->tail) return -1;
-    void* item = queue->data + queue->item_size*queue->head;
+    void* item = queue->data + queue->item_size * (queue->head & (queue->capacity - 1));
     queue->value_constuctor(dst, item, queue->item_size);
     return 0;
 }
@@ -50,3 +100,216 @@ int queue_destroy(queue_t *queue)
     free(queue);
     return 0;
 }
+
+/// @brief 创建无锁单生产者单消费者环形队列
+/// @param capacity 容量，向上取整到2的幂
+/// @param item_size 元素长度，一般是指针
+/// @return 队列指针，内存不足为NULL
+spsc_t *spsc_init(size_t capacity, size_t item_size)
+{
+    size_t size = 1;
+    while (size < capacity) size *= 2;
+    spsc_t *ring = (spsc_t*)calloc(1, sizeof(spsc_t));
+    if (ring == NULL) return NULL;
+    ring->data = (uint8_t*)malloc(size * item_size);
+    if (ring->data == NULL)
+    {
+        free(ring);
+        return NULL;
+    }
+    ring->mask = size - 1;
+    ring->item_size = item_size;
+    return ring;
+}
+
+/// @brief 内部函数，在环形存储区的pos处开始拷入或拷出n个元素，处理回绕
+static void spsc_copy(spsc_t *ring, size_t pos, uint8_t *items, size_t n, int in)
+{
+    size_t start = pos & ring->mask;
+    size_t first = ring->mask + 1 - start < n ? ring->mask + 1 - start : n;
+    uint8_t *slot = ring->data + start * ring->item_size;
+    if (in)
+    {
+        memcpy(slot, items, first * ring->item_size);
+        memcpy(ring->data, items + first * ring->item_size, (n - first) * ring->item_size);
+    }
+    else
+    {
+        memcpy(items, slot, first * ring->item_size);
+        memcpy(items + first * ring->item_size, ring->data, (n - first) * ring->item_size);
+    }
+}
+
+/// @brief 批量入队，只能由生产者线程调用
+/// @param items 连续存放的n个元素
+/// @return 实际入队的个数，队列满时可能小于n
+size_t spsc_push_batch(spsc_t *ring, const void *items, size_t n)
+{
+    size_t tail = ring->tail;
+    size_t capacity = ring->mask + 1;
+    if (capacity - (tail - ring->head_cache) < n)
+        ring->head_cache = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    size_t space = capacity - (tail - ring->head_cache);
+    if (n > space) n = space;
+    if (n == 0) return 0;
+    spsc_copy(ring, tail, (uint8_t*)items, n, 1);
+    __atomic_store_n(&ring->tail, tail + n, __ATOMIC_RELEASE);
+    return n;
+}
+
+/// @brief 批量出队，只能由消费者线程调用
+/// @param dst 连续存放出队的元素，至少能放n个
+/// @return 实际出队的个数，队列空时为0
+size_t spsc_pop_batch(spsc_t *ring, void *dst, size_t n)
+{
+    size_t head = ring->head;
+    if (ring->tail_cache - head < n)
+        ring->tail_cache = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    size_t avail = ring->tail_cache - head;
+    if (n > avail) n = avail;
+    if (n == 0) return 0;
+    spsc_copy(ring, head, (uint8_t*)dst, n, 0);
+    __atomic_store_n(&ring->head, head + n, __ATOMIC_RELEASE);
+    return n;
+}
+
+/// @brief 入队一个元素，只能由生产者线程调用
+/// @return 成功为0，队列满为-1
+int spsc_push(spsc_t *ring, const void *item)
+{
+    return spsc_push_batch(ring, item, 1) == 1 ? 0 : -1;
+}
+
+/// @brief 出队一个元素，只能由消费者线程调用
+/// @return 成功为0，队列空为-1
+int spsc_pop(spsc_t *ring, void *dst)
+{
+    return spsc_pop_batch(ring, dst, 1) == 1 ? 0 : -1;
+}
+
+/// @brief 队列中的元素个数，其他线程同时操作时只是近似值
+size_t spsc_len(spsc_t *ring)
+{
+    size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    return tail - head;
+}
+
+/// @brief 销毁队列，之后不能再有线程使用它
+void spsc_destroy(spsc_t *ring)
+{
+    free(ring->data);
+    free(ring);
+}
+
+/// @brief 内部函数，第index个单元的序号
+static size_t *mpmc_cell_seq(mpmc_t *queue, size_t index)
+{
+    return (size_t*)(queue->cells + (index & queue->mask) * queue->cell_size);
+}
+
+/// @brief 创建有界无锁多生产者多消费者队列
+/// @param capacity 容量，向上取整到2的幂，至少为2
+/// @param item_size 元素长度，一般是指针
+/// @return 队列指针，内存不足为NULL
+mpmc_t *mpmc_init(size_t capacity, size_t item_size)
+{
+    size_t size = 2;
+    while (size < capacity) size *= 2;
+    mpmc_t *queue = (mpmc_t*)calloc(1, sizeof(mpmc_t));
+    if (queue == NULL) return NULL;
+    queue->cell_size = (sizeof(size_t) + item_size + sizeof(size_t) - 1) / sizeof(size_t) * sizeof(size_t);
+    queue->cells = (uint8_t*)malloc(size * queue->cell_size);
+    if (queue->cells == NULL)
+    {
+        free(queue);
+        return NULL;
+    }
+    queue->mask = size - 1;
+    queue->item_size = item_size;
+    // 第i个单元等待第i个生产者
+    for (size_t i = 0; i < size; i++)
+        *mpmc_cell_seq(queue, i) = i;
+    return queue;
+}
+
+/// @brief 入队，可以由多个线程同时调用
+/// @return 成功为0，队列满为-1
+int mpmc_push(mpmc_t *queue, const void *item)
+{
+    size_t pos = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+    for (;;)
+    {
+        size_t *seq = mpmc_cell_seq(queue, pos);
+        intptr_t diff = (intptr_t)__atomic_load_n(seq, __ATOMIC_ACQUIRE) - (intptr_t)pos;
+        if (diff == 0)
+        {
+            // 单元空闲，抢占这个位置
+            if (__atomic_compare_exchange_n(&queue->tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                memcpy(seq + 1, item, queue->item_size);
+                __atomic_store_n(seq, pos + 1, __ATOMIC_RELEASE);
+                return 0;
+            }
+        }
+        else if (diff < 0)
+            return -1; // 单元还没被上一轮消费，队列满
+        else
+            pos = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+    }
+}
+
+/// @brief 批量出队，可以由多个线程同时调用，一次抢占连续的已就绪单元
+/// @param dst 连续存放出队的元素，至少能放n个
+/// @return 实际出队的个数，队列空时为0
+size_t mpmc_pop_batch(mpmc_t *queue, void *dst, size_t n)
+{
+    size_t pos = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+    for (;;)
+    {
+        // 数出从pos开始已经写好的单元，它们只会在head越过之后才变化
+        size_t ready = 0;
+        while (ready < n && __atomic_load_n(mpmc_cell_seq(queue, pos + ready), __ATOMIC_ACQUIRE) == pos + ready + 1)
+            ready++;
+        if (ready == 0)
+        {
+            intptr_t diff = (intptr_t)__atomic_load_n(mpmc_cell_seq(queue, pos), __ATOMIC_ACQUIRE) - (intptr_t)(pos + 1);
+            if (diff < 0)
+                return 0; // 单元还没被写入，队列空
+            pos = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+            continue;
+        }
+        if (!__atomic_compare_exchange_n(&queue->head, &pos, pos + ready, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            continue;
+        for (size_t i = 0; i < ready; i++)
+        {
+            size_t *seq = mpmc_cell_seq(queue, pos + i);
+            memcpy((uint8_t*)dst + i * queue->item_size, seq + 1, queue->item_size);
+            // 留给下一轮的生产者
+            __atomic_store_n(seq, pos + i + queue->mask + 1, __ATOMIC_RELEASE);
+        }
+        return ready;
+    }
+}
+
+/// @brief 出队一个元素，可以由多个线程同时调用
+/// @return 成功为0，队列空为-1
+int mpmc_pop(mpmc_t *queue, void *dst)
+{
+    return mpmc_pop_batch(queue, dst, 1) == 1 ? 0 : -1;
+}
+
+/// @brief 队列中的元素个数，用于背压，其他线程同时操作时只是近似值
+size_t mpmc_depth(mpmc_t *queue)
+{
+    size_t head = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+    size_t tail = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+    return tail > head ? tail - head : 0;
+}
+
+/// @brief 销毁队列，之后不能再有线程使用它
+void mpmc_destroy(mpmc_t *queue)
+{
+    free(queue->cells);
+    free(queue);
+}
@@ -1,16 +1,20 @@
 #include <assert.h>
+#include <stdlib.h>
 #include "map.h"
 #include "tcp.h"
 #include "icmp.h"
 #include "ip.h"
+#include "log.h"
+#include "trace.h"
 
 static void panic(const char* msg, int line) {
-    printf("panic %s! at line %d\n", msg, line);
+    log_error("panic %s! at line %d", msg, line);
+    log_flush();
     assert(0);
 }
 
 static void display_flags(tcp_flags_t flags) {
-    printf("flags:%s%s%s%s%s%s%s%s\n",
+    log_debug("flags:%s%s%s%s%s%s%s%s",
         flags.cwr ? " cwr" : "",
         flags.ece ? " ece" : "",
         flags.urg ? " urg" : "",
@@ -22,16 +26,32 @@ static void display_flags(tcp_flags_t flags) {
     );
 }
 
+/**
+ * @brief 切换连接状态，并记录一条状态变化的跟踪
+ *
+ * @param connect
+ * @param state 新状态
+ */
+static void tcp_set_state(tcp_connect_t* connect, tcp_state_t state) {
+    TRACE(TRACE_TCP, TRACE_STATE, state, NET_PROTOCOL_TCP, connect->ip, net_if_ip, connect->remote_port, connect->local_port, 0);
+    connect->state = state;
+}
+
 // dst-port -> handler
 static map_t tcp_table; //tcp_table里面放了一个dst_port的回调函数
 
 // tcp_key_t[IP, src port, dst port] -> tcp_connect_t
 
 /* Connect_table放置了一堆TCP连接，
-    KEY为[IP，src port，dst port], 即tcp_key_t，VALUE为tcp_connect_t。
+    KEY为[IP，src port，dst port], 即tcp_key_t，VALUE为堆上分配的tcp_connect_t的指针。
+    map扩容缩容时会移动值，连接本身不动。
+    连接空闲TCP_IDLE_TIMEOUT_SEC后超时，删除或超时时由析构函数释放缓存并放掉表的引用；
+    应用层要跨poll持有连接指针时用tcp_connect_get增加引用，连接在引用放完后才释放。
 */
 static map_t connect_table; 
 
+static void tcp_connect_destroy(void* value);
+
 /**
  * @brief 生成一个用于 connect_table 的 key
  *
@@ -55,7 +75,10 @@ static tcp_key_t new_tcp_key(uint8_t ip[NET_IP_LEN], uint16_t src_port, uint16_t
  */
 void tcp_init() {
     map_init(&tcp_table, sizeof(uint16_t), sizeof(tcp_handler_t), 0, 0, NULL);
-    map_init(&connect_table, sizeof(tcp_key_t), sizeof(tcp_connect_t), 0, 0, NULL);
+    map_set_name(&tcp_table, "tcp_table");
+    map_init(&connect_table, sizeof(tcp_key_t), sizeof(tcp_connect_t*), 0, TCP_IDLE_TIMEOUT_SEC * 1000, NULL);
+    map_set_name(&connect_table, "connect_table");
+    map_set_destructor(&connect_table, tcp_connect_destroy);
     net_add_protocol(NET_PROTOCOL_TCP, tcp_in);
 }
 
@@ -68,7 +91,7 @@ void tcp_init() {
  * @return int
  */
 int tcp_open(uint16_t port, tcp_handler_t handler) {
-    printf("tcp open\n");
+    log_info("tcp open on port %u", port);
     return map_set(&tcp_table, &port, &handler);
 }
 
@@ -80,75 +103,111 @@ int tcp_open(uint16_t port, tcp_handler_t handler) {
  */
 static void init_tcp_connect_rcvd(tcp_connect_t* connect) {
     if (connect->state == TCP_LISTEN) {
-        connect->rx_buf = malloc(sizeof(buf_t));
-        connect->tx_buf = malloc(sizeof(buf_t));
+        connect->rx_buf = buf_alloc(0);
+        connect->tx_buf = buf_alloc(0);
     }
     buf_init(connect->rx_buf, 0);
     buf_init(connect->tx_buf, 0);
-    connect->state = TCP_SYN_RCVD;
+    // 收发缓存要装下整个窗口，使用窗口大小的size class
+    buf_reserve(connect->rx_buf, TCP_WINDOW_LEN);
+    buf_reserve(connect->tx_buf, TCP_WINDOW_LEN);
+    tcp_set_state(connect, TCP_SYN_RCVD);
 }
 
 /**
  * @brief 释放TCP连接，这会释放分配的空间，并把状态变回LISTEN。
- *        一般这个后边都会跟个map_delete(&connect_table, &key)把状态变回CLOSED
+ *        map_delete(&connect_table, &key)会通过析构函数调用它，把状态变回CLOSED
  *
  * @param connect
  */
 static void release_tcp_connect(tcp_connect_t* connect) {
     if (connect->state == TCP_LISTEN)
         return;
-    free(connect->rx_buf);
-    free(connect->tx_buf);
-    connect->state = TCP_LISTEN;
+    buf_put(connect->rx_buf);
+    buf_put(connect->tx_buf);
+    tcp_set_state(connect, TCP_LISTEN);
+}
+
+/**
+ * @brief connect_table的值析构函数，连接被删除或空闲超时时释放缓存，标记为已删除并放掉表的引用
+ *
+ * @param value 存放tcp_connect_t指针的地址
+ */
+static void tcp_connect_destroy(void* value) {
+    tcp_connect_t* connect = *(tcp_connect_t**)value;
+    release_tcp_connect(connect);
+    connect->removed = 1;
+    tcp_connect_put(connect);
+}
+
+/**
+ * @brief 获取连接的一个引用，用于在回调返回后继续持有连接
+ *        供应用层使用，用完后要调用tcp_connect_put
+ *
+ * @param connect
+ * @return tcp_connect_t* 即connect
+ */
+tcp_connect_t* tcp_connect_get(tcp_connect_t* connect) {
+    connect->ref++;
+    return connect;
+}
+
+/**
+ * @brief 放掉连接的一个引用，引用计数归零时释放连接
+ *        供应用层使用
+ *
+ * @param connect
+ */
+void tcp_connect_put(tcp_connect_t* connect) {
+    if (--connect->ref == 0)
+        free(connect);
+}
+
+/**
+ * @brief 连接是否还在connect_table中。对端关闭、复位或空闲超时后为0，此时读写和关闭都不再生效
+ *        供应用层使用，持有引用时在每次net_poll后检查
+ *
+ * @param connect
+ * @return int 还在为1
+ */
+int tcp_connect_is_open(tcp_connect_t* connect) {
+    return !connect->removed;
 }
 
 /**
  * @brief 计算tcp checksum
- * 自动以大端方式返回
+ * 自动以大端方式返回。伪头部按参数直接求和，不修改buf
  * 
- * @param buf 
+ * @param buf 可以是scatter-gather链
  * @param src_ip 
  * @param dst_ip 
  * @return uint16_t 
  */
 static uint16_t tcp_checksum(buf_t* buf, uint8_t* src_ip, uint8_t* dst_ip) {
-    buf_t tmp_buf;
-    buf_copy(&tmp_buf, buf, sizeof(buf));
-    buf_add_header(&tmp_buf, sizeof(tcp_peso_hdr_t));
-    tcp_peso_hdr_t *peso_hdr = (tcp_peso_hdr_t *)tmp_buf.data;
-    memcpy(peso_hdr->src_ip, src_ip, NET_IP_LEN);
-    memcpy(peso_hdr->dst_ip, dst_ip, NET_IP_LEN);
-    peso_hdr->placeholder = 0;
-    peso_hdr->protocol = NET_PROTOCOL_TCP;
-    peso_hdr->total_len16 = swap16(buf->len);
-    uint16_t checksum = checksum16((uint16_t*)peso_hdr, tmp_buf.len);
-    return checksum;
+    uint32_t sum = checksum16_pseudo(src_ip, dst_ip, NET_PROTOCOL_TCP, buf_chain_len(buf));
+    return checksum16_finish(sum + buf_checksum16_partial(buf));
 }
 
-static _Thread_local uint16_t delete_port;
-
 /**
- * @brief tcp_close使用这个函数来查找可以关闭的连接，使用thread-local变量delete_port传递端口号。
+ * @brief tcp_close使用这个函数来判断连接是否在要关闭的端口上
  *
- * @param key,value,timestamp
+ * @param key,value
+ * @param arg 要关闭的端口号
+ * @return int 要删除为1
  */
-static void close_port_fn(void* key, void* value, time_t* timestamp) {
+static int close_port_fn(void* key, void* value, void* arg) {
     tcp_key_t* tcp_key = key;
-    tcp_connect_t* connect = value;
-    if (tcp_key->dst_port == delete_port) {
-        release_tcp_connect(connect);
-    }
+    return tcp_key->dst_port == *(uint16_t*)arg;
 }
 
 /**
  * @brief 关闭 port 上的 TCP 连接
- *        供应用层使用
+ *        供应用层使用，连接会从connect_table中删除并释放
  *
  * @param port
  */
 void tcp_close(uint16_t port) {
-    delete_port = port;
-    map_foreach(&connect_table, close_port_fn);
+    map_delete_if(&connect_table, close_port_fn, &port);
     map_delete(&tcp_table, &port);
 }
 
@@ -168,7 +227,8 @@ static uint16_t tcp_read_from_buf(tcp_connect_t* connect, buf_t* buf) {
 }
 
 /**
- * @brief 把connect内tx_buf的数据写入到buf里面供tcp_send使用，buf原来的内容会无效。
+ * @brief 把connect内tx_buf的数据以切片的形式链接到buf后面供tcp_send使用，buf原来的内容会无效。
+ *        切片持有tx_buf的引用，不拷贝数据。
  *
  * @param connect
  * @param buf
@@ -177,24 +237,29 @@ static uint16_t tcp_read_from_buf(tcp_connect_t* connect, buf_t* buf) {
 static uint16_t tcp_write_to_buf(tcp_connect_t* connect, buf_t* buf) {
     uint16_t sent = connect->next_seq - connect->unack_seq;
     uint16_t size = min32(connect->tx_buf->len - sent, connect->remote_win);
-    buf_init(buf, size);
-    memcpy(buf->data, connect->tx_buf->data + sent, size);
+    buf_init(buf, 0);
+    if (size) {
+        buf_t* slice = buf_slice(connect->tx_buf, sent, size);
+        if (slice == NULL) return 0;
+        buf_chain(buf, slice);
+    }
     connect->next_seq += size;
     return size;
 }
 
 /**
- * @brief 发送TCP包, seq_number32 = connect->next_seq - buf->len
+ * @brief 发送TCP包, seq_number32 = connect->next_seq - buf_chain_len(buf)
  *        buf里的数据将作为负载，加上tcp头发送出去。如果flags包含syn或fin，seq会递增。
+ *        buf可以是scatter-gather链，tcp头加在链头。
  *
  * @param buf
  * @param connect
  * @param flags
  */
 static void tcp_send(buf_t* buf, tcp_connect_t* connect, tcp_flags_t flags) {
-    printf("<< tcp send >> sz=%zu\n", buf->len);
+    size_t prev_len = buf_chain_len(buf);
+    log_debug("<< tcp send >> sz=%zu", prev_len);
     display_flags(flags);
-    size_t prev_len = buf->len;
     buf_add_header(buf, sizeof(tcp_hdr_t));
     tcp_hdr_t* hdr = (tcp_hdr_t*)buf->data;
     hdr->src_port16 = swap16(connect->local_port);
@@ -221,14 +286,18 @@ static void tcp_send(buf_t* buf, tcp_connect_t* connect, tcp_flags_t flags) {
  * @param connect
  */
 void tcp_connect_close(tcp_connect_t* connect) {
+    if (connect->removed)
+        return;
     if (connect->state == TCP_ESTABLISHED) {
-        tcp_write_to_buf(connect, &txbuf);
-        tcp_send(&txbuf, connect, tcp_flags_ack_fin);
-        connect->state = TCP_FIN_WAIT_1;
+        buf_t* buf = buf_alloc(0);
+        if (buf == NULL) return;
+        tcp_write_to_buf(connect, buf);
+        tcp_send(buf, connect, tcp_flags_ack_fin);
+        buf_put(buf);
+        tcp_set_state(connect, TCP_FIN_WAIT_1);
         return;
     }
     tcp_key_t key = new_tcp_key(connect->ip, connect->remote_port, connect->local_port);
-    release_tcp_connect(connect);
     map_delete(&connect_table, &key);
 }
 
@@ -242,6 +311,8 @@ void tcp_connect_close(tcp_connect_t* connect) {
  * @return size_t
  */
 size_t tcp_connect_read(tcp_connect_t* connect, uint8_t* data, size_t len) {
+    if (connect->removed)
+        return 0;
     buf_t* rx_buf = connect->rx_buf;
     size_t size = min32(rx_buf->len, len);
     memcpy(data, rx_buf->data, size);
@@ -262,20 +333,27 @@ size_t tcp_connect_read(tcp_connect_t* connect, uint8_t* data, size_t len) {
  */
 size_t tcp_connect_write(tcp_connect_t* connect, const uint8_t* data, size_t len) {
     // printf("tcp_connect_write size: %zu\n", len);
+    if (connect->removed)
+        return 0;
     buf_t* tx_buf = connect->tx_buf;
 
     uint8_t* dst = tx_buf->data + tx_buf->len;
-    size_t size = min32(&tx_buf->payload[BUF_MAX_LEN] - dst, len);
+    size_t size = min32(tx_buf->payload + tx_buf->cap - dst, len);
 
     if (connect->next_seq - connect->unack_seq + len >= connect->remote_win) {
         return 0;
     }
     if (buf_add_padding(tx_buf, size) != 0) {
+        // 还有已发送的切片引用tx_buf时不能移动数据
+        if (tx_buf->ref > 1) return 0;
         memmove(tx_buf->payload, tx_buf->data, tx_buf->len);
         tx_buf->data = tx_buf->payload;
-        if (tcp_write_to_buf(connect, &txbuf)) {
-            tcp_send(&txbuf, connect, tcp_flags_ack);
+        buf_t* buf = buf_alloc(0);
+        if (buf == NULL) return 0;
+        if (tcp_write_to_buf(connect, buf)) {
+            tcp_send(buf, connect, tcp_flags_ack);
         }
+        buf_put(buf);
         return 0;
     }
     memcpy(dst, data, size);
@@ -283,35 +361,52 @@ size_t tcp_connect_write(tcp_connect_t* connect, const uint8_t* data, size_t len
 }
 
 
+/**
+ * @brief 查找key对应的连接
+ *
+ * @param key
+ * @return tcp_connect_t* 没有找到返回NULL
+ */
+static tcp_connect_t* tcp_connect_find(tcp_key_t* key) {
+    tcp_connect_t** connect = map_get(&connect_table, key);
+    return connect ? *connect : NULL;
+}
+
 static tcp_connect_t* tcp_connect_init(tcp_key_t* key, tcp_handler_t handler) {
-    tcp_connect_t connect;
-    connect.state = TCP_LISTEN;
-    connect.local_port = key->dst_port;
-    connect.remote_port = key->src_port;
-    memcpy(connect.ip, key->ip, NET_IP_LEN);
-    connect.handler = handler;
-    map_set(&connect_table, key, &connect);
-    return map_get(&connect_table, key);
+    tcp_connect_t* connect = calloc(1, sizeof(tcp_connect_t));
+    if (connect == NULL)
+        return NULL;
+    connect->state = TCP_LISTEN;
+    connect->local_port = key->dst_port;
+    connect->remote_port = key->src_port;
+    memcpy(connect->ip, key->ip, NET_IP_LEN);
+    connect->handler = handler;
+    connect->ref = 1;
+    if (map_set(&connect_table, key, &connect) != 0) {
+        free(connect);
+        return NULL;
+    }
+    return connect;
 }
 
 void close_tcp(tcp_key_t key)
 {
     
-    printf("!!! connection closed !!!\n");
-    tcp_connect_t* connect = map_get(&connect_table, &key);
-    if (connect == NULL) return;
-    release_tcp_connect(connect);
+    log_info("!!! connection closed !!!");
     map_delete(&connect_table, &key);
 }
 
 void reset_tcp(tcp_key_t key, uint32_t get_seq)
 {
-    printf("!!! reset tcp when recv seq %d !!!\n", get_seq);
-    tcp_connect_t* connect = map_get(&connect_table, &key);
+    log_warn("!!! reset tcp when recv seq %u !!!", get_seq);
+    tcp_connect_t* connect = tcp_connect_find(&key);
     connect->next_seq = 0;
     connect->ack = get_seq + 1;
-    buf_init(&txbuf, 0);
-    tcp_send(&txbuf, connect, tcp_flags_ack_rst);
+    buf_t* buf = buf_alloc(0);
+    if (buf != NULL) {
+        tcp_send(buf, connect, tcp_flags_ack_rst);
+        buf_put(buf);
+    }
     close_tcp(key);
 }
 
@@ -322,34 +417,28 @@ void reset_tcp(tcp_key_t key, uint32_t get_seq)
  * @param src_ip
  */
 void tcp_in(buf_t* buf, uint8_t* src_ip) {
-    printf("<<< tcp_in >>>\n");
+    log_debug("<<< tcp_in >>>");
 
     /*
     1、大小检查，检查buf长度是否小于tcp头部，如果是，则丢弃
     */
     if (buf->len < sizeof(tcp_hdr_t)) return;
 
-    // 备份不存在的ip头
-    ip_hdr_t old_ip_hdr;
-    ip_hdr_t* ip_hdr = (ip_hdr_t*)((void*)buf->data - sizeof(ip_hdr_t));
-    memcpy(&old_ip_hdr, ip_hdr, sizeof(ip_hdr_t));
-
     tcp_hdr_t* hdr = (tcp_hdr_t*)(buf->data);
     /*
     2、检查checksum字段，如果checksum出错，则丢弃
+       连同校验和字段一起求和，正确时为0，不修改数据包（可能是驱动的只读帧缓冲）
     */ 
-    uint16_t original_checksum = hdr->checksum16;
-    hdr->checksum16 = 0;
-    uint16_t calcu_checksum = tcp_checksum(buf, src_ip, net_if_ip);
-    hdr->checksum16 = original_checksum;
-    if (original_checksum != calcu_checksum) return;
+    if (tcp_checksum(buf, src_ip, net_if_ip) != 0) return;
 
     /*
     3、从tcp头部字段中获取source port、destination port、
     sequence number、acknowledge number、flags，注意大小端转换
     */
-    uint16_t src_port = swap16(hdr->src_port16);
-    uint16_t dst_port = swap16(hdr->dst_port16);
+    buf->src_port = swap16(hdr->src_port16);
+    buf->dst_port = swap16(hdr->dst_port16);
+    uint16_t src_port = buf->src_port;
+    uint16_t dst_port = buf->dst_port;
     uint32_t seq_number = swap32(hdr->seq_number32);
     uint32_t ack_number = swap32(hdr->ack_number32);
     tcp_flags_t flags = hdr->flags;
@@ -360,12 +449,10 @@ void tcp_in(buf_t* buf, uint8_t* src_ip) {
     */
     tcp_handler_t* handler_ptr = map_get(&tcp_table, &dst_port);
     if (handler_ptr == NULL) {
-        // port unreachable
-        buf_add_header(buf, sizeof(ip_hdr_t));
-        // restore header
-        memcpy(buf->data, &old_ip_hdr, sizeof(ip_hdr_t));
+        // port unreachable，ip头由ip_in记录在buf->l3
         icmp_unreachable(buf, src_ip, ICMP_CODE_PORT_UNREACH);
-    };
+        return;
+    }
     tcp_handler_t handler = *handler_ptr;
 
     /*
@@ -377,10 +464,17 @@ void tcp_in(buf_t* buf, uint8_t* src_ip) {
     6、调用map_get函数，根据key查找一个tcp_connect_t* connect，
     如果没有找到，则调用map_set建立新的链接，并设置为CONNECT_LISTEN状态，然后调用mag_get获取到该链接。
     */
-    tcp_connect_t* connect = map_get(&connect_table, &key);
+    tcp_connect_t* connect = tcp_connect_find(&key);
     if (connect == NULL)
     {
         connect = tcp_connect_init(&key, handler);
+        if (connect == NULL)
+            return;
+    }
+    else
+    {
+        // 收到报文，重新开始空闲计时
+        map_touch(&connect_table, &key);
     }
 
     /*
@@ -398,8 +492,8 @@ void tcp_in(buf_t* buf, uint8_t* src_ip) {
             unack_seq（设为随机值）、由于是对syn的ack应答包，next_seq与unack_seq一致
             ack设为对方的sequence number+1
             设置remote_win为对方的窗口大小，注意大小端转换
-        （5）调用buf_init初始化txbuf
-        （6）调用tcp_send将txbuf发送出去，也就是回复一个tcp_flags_ack_syn（SYN+ACK）报文
+        （5）调用buf_alloc从缓冲池分配发送buf
+        （6）调用tcp_send将其发送出去，也就是回复一个tcp_flags_ack_syn（SYN+ACK）报文，再buf_put释放
         （7）处理结束，返回。
     */
     if (connect->state == TCP_LISTEN)
@@ -422,8 +516,10 @@ void tcp_in(buf_t* buf, uint8_t* src_ip) {
             connect->next_seq = connect->unack_seq;
             connect->ack = seq_number + 1;
             connect->remote_win = win;
-            buf_init(&txbuf, 0);
-            tcp_send(&txbuf, connect, tcp_flags_ack_syn);
+            buf_t* tx = buf_alloc(0);
+            if (tx == NULL) return;
+            tcp_send(tx, connect, tcp_flags_ack_syn);
+            buf_put(tx);
         }
         return;
     }
@@ -473,7 +569,7 @@ void tcp_in(buf_t* buf, uint8_t* src_ip) {
                 （3）调用回调函数，完成三次握手，进入连接状态TCP_CONN_CONNECTED。
             */
             connect->unack_seq++;
-            connect->state = TCP_ESTABLISHED;
+            tcp_set_state(connect, TCP_ESTABLISHED);
             ((tcp_handler_t)(connect->handler))(connect, TCP_CONN_CONNECTED);
             break;
 
@@ -506,7 +602,7 @@ void tcp_in(buf_t* buf, uint8_t* src_ip) {
 
             /*
             17、再然后，根据当前的标志位进一步处理
-                （1）首先调用buf_init初始化txbuf
+                （1）首先调用buf_alloc从缓冲池分配发送buf，用完后buf_put释放
                 （2）判断是否收到关闭请求（FIN），如果是，将状态改为TCP_LAST_ACK，ack +1，再发送一个ACK + FIN包，并退出，
                     这样就无需进入CLOSE_WAIT，直接等待对方的ACK
                 （3）如果不是FIN，则看看是否有数据，如果有，则发ACK相应，并调用handler回调函数进行处理
@@ -514,26 +610,29 @@ void tcp_in(buf_t* buf, uint8_t* src_ip) {
                 （5）没有收到数据，可能对方只发一个ACK，可以不响应
 
             */
-            buf_init(&txbuf, 0);
+            buf_t* tx = buf_alloc(0);
+            if (tx == NULL) return;
             if (flags.fin)
             {
-                connect->state = TCP_LAST_ACK;
+                tcp_set_state(connect, TCP_LAST_ACK);
                 connect->ack++;
-                tcp_send(&txbuf, connect, tcp_flags_ack_fin);
+                tcp_send(tx, connect, tcp_flags_ack_fin);
+                buf_put(tx);
                 return;
             }
 
             // 收数据
             if (buf->len > 0) {
                 ((tcp_handler_t)(connect->handler))(connect, TCP_CONN_DATA_RECV);
-                tcp_write_to_buf(connect, &txbuf);
-                tcp_send(&txbuf, connect, tcp_flags_ack);
+                tcp_write_to_buf(connect, tx);
+                tcp_send(tx, connect, tcp_flags_ack);
             } else {
                 // 无数据，发null
-                if (tcp_write_to_buf(connect, &txbuf)) {
-                    tcp_send(&txbuf, connect, tcp_flags_null);
+                if (tcp_write_to_buf(connect, tx)) {
+                    tcp_send(tx, connect, tcp_flags_null);
                 }
             }
+            buf_put(tx);
             break;
 
         case TCP_CLOSE_WAIT:
@@ -552,19 +651,22 @@ void tcp_in(buf_t* buf, uint8_t* src_ip) {
             }
             else if (flags.ack)
             {
-                connect->state = TCP_FIN_WAIT_2;
+                tcp_set_state(connect, TCP_FIN_WAIT_2);
             }
             break;
 
         case TCP_FIN_WAIT_2:
             /*
             19、如果不是FIN，则不做处理
-                如果是，则将ACK +1，调用buf_init初始化txbuf，调用tcp_send发送一个ACK数据包，再close_tcp关闭TCP
+                如果是，则将ACK +1，调用buf_alloc分配发送buf，调用tcp_send发送一个ACK数据包，再close_tcp关闭TCP
             */
             if (!flags.fin) return;
             connect->ack++;
-            buf_init(&txbuf, 0);
-            tcp_send(&txbuf, connect, tcp_flags_ack);
+            buf_t* ack_buf = buf_alloc(0);
+            if (ack_buf != NULL) {
+                tcp_send(ack_buf, connect, tcp_flags_ack);
+                buf_put(ack_buf);
+            }
             close_tcp(key);
             break;
 
@@ -0,0 +1,173 @@
+#include "timer.h"
+
+/**
+ * @brief 分层时间轮，第0层每槽一个tick，往上每层每槽的跨度乘以TIMER_LEVEL_SLOTS
+ * 
+ */
+static net_timer_t *timer_wheel[TIMER_LEVELS][TIMER_LEVEL_SLOTS];
+
+/**
+ * @brief 时间轮当前的tick，这个tick及之前到期的定时器都已触发
+ * 
+ */
+static uint64_t timer_tick;
+
+/**
+ * @brief 时间轮中的定时器数量，为0时timer_poll直接跳到当前时间
+ * 
+ */
+static size_t timer_count;
+
+/**
+ * @brief 内部函数，把定时器从所在链表中摘下
+ * 
+ * @param timer 要摘下的定时器
+ */
+static void timer_unlink(net_timer_t *timer)
+{
+    *timer->pprev = timer->next;
+    if (timer->next)
+        timer->next->pprev = timer->pprev;
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+/**
+ * @brief 内部函数，按到期时间把定时器放进对应层的槽中
+ * 
+ * @param timer 要放入的定时器
+ */
+static void timer_place(net_timer_t *timer)
+{
+    uint64_t expire = timer->expire;
+    if (expire <= timer_tick)
+        expire = timer_tick + 1;
+    else if (expire - timer_tick >= TIMER_MAX_TICKS)
+        expire = timer_tick + TIMER_MAX_TICKS - 1; // 超出时间轮范围的先放在最高层，级联时重新放置
+    uint64_t delta = expire - timer_tick;
+    int level = 0;
+    while (level < TIMER_LEVELS - 1 && delta >= ((uint64_t)1 << (TIMER_LEVEL_BITS * (level + 1))))
+        level++;
+    net_timer_t **slot = &timer_wheel[level][(expire >> (TIMER_LEVEL_BITS * level)) & (TIMER_LEVEL_SLOTS - 1)];
+    timer->next = *slot;
+    if (*slot)
+        (*slot)->pprev = &timer->next;
+    timer->pprev = slot;
+    *slot = timer;
+}
+
+/**
+ * @brief 内部函数，把一个槽中的所有定时器取出并重新放置到下层
+ * 
+ * @param level 层
+ * @param index 槽
+ */
+static void timer_cascade(int level, size_t index)
+{
+    net_timer_t *list = timer_wheel[level][index];
+    timer_wheel[level][index] = NULL;
+    while (list)
+    {
+        net_timer_t *timer = list;
+        list = timer->next;
+        timer_place(timer);
+    }
+}
+
+/**
+ * @brief 初始化时间轮
+ * 
+ * @param now 当前时间，毫秒
+ */
+void timer_init(uint64_t now)
+{
+    timer_tick = now / TIMER_TICK_MS;
+}
+
+/**
+ * @brief 启动定时器，已在时间轮中的定时器会被重新设置
+ * 
+ * @param timer 定时器
+ * @param expire 到期时间，与net_now()同单位的毫秒数
+ * @param handler 到期时调用的回调函数，调用前定时器已从时间轮中摘下，回调中可以重新启动或释放定时器
+ * @param arg 回调函数的参数
+ */
+void timer_add(net_timer_t *timer, uint64_t expire, timer_handler_t handler, void *arg)
+{
+    if (timer_pending(timer))
+        timer_cancel(timer);
+    timer->expire = (expire + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+    timer->handler = handler;
+    timer->arg = arg;
+    timer_place(timer);
+    timer_count++;
+}
+
+/**
+ * @brief 取消定时器，不在时间轮中时什么也不做
+ * 
+ * @param timer 定时器
+ */
+void timer_cancel(net_timer_t *timer)
+{
+    if (!timer_pending(timer))
+        return;
+    timer_unlink(timer);
+    timer_count--;
+}
+
+/**
+ * @brief 判断定时器是否在时间轮中
+ * 
+ * @param timer 定时器
+ * @return int 在时间轮中为1，否则为0
+ */
+int timer_pending(const net_timer_t *timer)
+{
+    return timer->pprev != NULL;
+}
+
+/**
+ * @brief 推进时间轮到当前时间，触发所有到期的定时器
+ *        每个tick只处理第0层的一个槽，上层的槽在下层转完一圈时级联，均摊O(1)
+ * 
+ * @param now 当前时间，毫秒
+ */
+void timer_poll(uint64_t now)
+{
+    uint64_t target = now / TIMER_TICK_MS;
+    while (timer_tick < target)
+    {
+        if (timer_count == 0)
+        {
+            timer_tick = target;
+            break;
+        }
+        timer_tick++;
+        for (int level = 1; level < TIMER_LEVELS; level++)
+        {
+            if ((timer_tick & (((uint64_t)1 << (TIMER_LEVEL_BITS * level)) - 1)) != 0)
+                break;
+            timer_cascade(level, (timer_tick >> (TIMER_LEVEL_BITS * level)) & (TIMER_LEVEL_SLOTS - 1));
+        }
+
+        // 先把槽整个取出，回调中可以增删定时器
+        net_timer_t *list = timer_wheel[0][timer_tick & (TIMER_LEVEL_SLOTS - 1)];
+        timer_wheel[0][timer_tick & (TIMER_LEVEL_SLOTS - 1)] = NULL;
+        if (list)
+            list->pprev = &list;
+        while (list)
+        {
+            net_timer_t *timer = list;
+            timer_unlink(timer);
+            if (timer->expire > timer_tick)
+            {
+                // 超出时间轮范围的定时器还没到期
+                timer_place(timer);
+                continue;
+            }
+            timer_count--;
+            timer->handler(timer->arg);
+        }
+    }
+}
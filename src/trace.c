@@ -0,0 +1,53 @@
+#include <stdio.h>
+#include <string.h>
+#include "trace.h"
+#include "net.h"
+
+#if TRACE_RING_LEN & (TRACE_RING_LEN - 1)
+#error "TRACE_RING_LEN must be a power of two"
+#endif
+
+/**
+ * @brief 跟踪环，写满后覆盖最旧的记录，只在trace_dump时读取
+ * 
+ */
+trace_record_t trace_ring[TRACE_RING_LEN];
+
+/**
+ * @brief 下一条记录的序号，对环长取模得到位置
+ * 
+ */
+uint64_t trace_seq;
+
+/**
+ * @brief 把环里的记录从旧到新写到文件，用trace_decode查看
+ *        在协议栈线程调用，和trace_write一样不加锁
+ * 
+ * @param path 文件路径
+ * @return int 成功为0，失败为-1
+ */
+int trace_dump(const char *path)
+{
+    uint64_t end = trace_seq;
+    uint64_t count = end < TRACE_RING_LEN ? end : TRACE_RING_LEN;
+    trace_file_hdr_t hdr;
+    memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+    hdr.version = TRACE_VERSION;
+    hdr.record_size = sizeof(trace_record_t);
+    hdr.count = count;
+    hdr.reserved = 0;
+    hdr.lost = end - count;
+
+    FILE *file = fopen(path, "wb");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Error in trace_dump: can not open %s\n", path);
+        return -1;
+    }
+    int ret = fwrite(&hdr, sizeof(hdr), 1, file) == 1 ? 0 : -1;
+    for (uint64_t seq = end - count; ret == 0 && seq != end; seq++)
+        if (fwrite(&trace_ring[seq & (TRACE_RING_LEN - 1)], sizeof(trace_record_t), 1, file) != 1)
+            ret = -1;
+    fclose(file);
+    return ret;
+}
@@ -10,32 +10,20 @@ map_t udp_table;
 
 /**
  * @brief udp伪校验和计算
- * checksum以大端方式存储
+ * checksum以大端方式存储，负载的反码和由调用者算好传入，这里只计算伪头部和udp头
+ * 伪头部按参数直接求和，不修改buf
  * 
- * @param buf 要计算的包
+ * @param buf 要计算的包，data指向udp头
  * @param src_ip 源ip地址
  * @param dst_ip 目的ip地址
+ * @param payload_sum udp头之后负载的16位反码和，可以在拷贝数据时用memcpy_csum顺便算出
  * @return uint16_t 伪校验和
  */
-static uint16_t udp_checksum(buf_t *buf, uint8_t *src_ip, uint8_t *dst_ip)
+static uint16_t udp_checksum(buf_t *buf, uint8_t *src_ip, uint8_t *dst_ip, uint32_t payload_sum)
 {
-    // 实现的checksum函数里本身就有对齐偶数的功能，在此不加padding
-
     udp_hdr_t* udp_hdr = (udp_hdr_t*)buf->data;
-    buf_add_header(buf, sizeof(udp_peso_hdr_t));
-    udp_peso_hdr_t *hdr = (udp_peso_hdr_t *)buf->data;
-    memcpy(hdr->src_ip, src_ip, NET_IP_LEN);
-    memcpy(hdr->dst_ip, dst_ip, NET_IP_LEN);
-    hdr->placeholder = 0;
-    hdr->protocol = NET_PROTOCOL_UDP;
-    hdr->total_len16 = udp_hdr->total_len16;
-
-    uint16_t checksum = checksum16((uint16_t *)buf->data, buf->len);
-
-    // 恢复buf
-    buf_remove_header(buf, sizeof(udp_peso_hdr_t));
-
-    return checksum;
+    uint32_t sum = checksum16_pseudo(src_ip, dst_ip, NET_PROTOCOL_UDP, swap16(udp_hdr->total_len16));
+    return checksum16_finish(checksum16_partial(udp_hdr, sizeof(udp_hdr_t), sum + payload_sum));
 }
 
 /**
@@ -47,59 +35,64 @@ static uint16_t udp_checksum(buf_t *buf, uint8_t *src_ip, uint8_t *dst_ip)
 void udp_in(buf_t *buf, uint8_t *src_ip)
 {
     if (buf->len < sizeof(udp_hdr_t)) return;
-    // 备份不存在的ip头
-    ip_hdr_t old_ip_hdr;
-    ip_hdr_t* ip_hdr = (ip_hdr_t*)((void*)buf->data - sizeof(ip_hdr_t));
-    memcpy(&old_ip_hdr, ip_hdr, sizeof(ip_hdr_t));
     udp_hdr_t* hdr = (udp_hdr_t*)buf->data;
 
-    // 检查checksum，都是大端   
-    uint16_t received_checksum = hdr->checksum16;
-    hdr->checksum16 = 0;
-    uint16_t cal_checksum = udp_checksum(buf, src_ip, net_if_ip);
-    if (cal_checksum != received_checksum) return;
-    hdr->checksum16 = received_checksum;
+    // 检查checksum，连同校验和字段一起求和，正确时为0，不修改数据包（可能是驱动的只读帧缓冲）
+    uint32_t payload_sum = checksum16_partial(buf->data + sizeof(udp_hdr_t), buf->len - sizeof(udp_hdr_t), 0);
+    if (udp_checksum(buf, src_ip, net_if_ip, payload_sum) != 0) return;
 
-    uint16_t src_port =  swap16(hdr->dst_port16);
-    udp_handler_t* handler_p = (udp_handler_t*)map_get(&udp_table, &src_port);
-    if (handler_p == NULL)
+    buf->src_port = swap16(hdr->src_port16);
+    buf->dst_port = swap16(hdr->dst_port16);
+    udp_handler_t handler;
+    if (map_read(&udp_table, &buf->dst_port, &handler) != 0)
     {
-        // port unreachable
-        buf_add_header(buf, sizeof(ip_hdr_t));
-        // restore header
-        memcpy(buf->data, &old_ip_hdr, sizeof(ip_hdr_t));
+        // port unreachable，ip头由ip_in记录在buf->l3
         icmp_unreachable(buf, src_ip, ICMP_CODE_PORT_UNREACH);
     }
     else
     {
         buf_remove_header(buf, sizeof(udp_hdr_t));
-        (*handler_p)(buf->data, buf->len, src_ip, src_port);
+        handler(buf->data, buf->len, src_ip, buf->dst_port);
     }
 }
 
 /**
- * @brief 处理一个要发送的数据包
+ * @brief 内部函数，加上udp头发送，负载的反码和已经算好
  * 
- * @param buf 要处理的包
+ * @param buf 要处理的包，可以是scatter-gather链
  * @param src_port 源端口号
  * @param dst_ip 目的ip地址
  * @param dst_port 目的端口号
+ * @param payload_sum 负载的16位反码和
  */
-void udp_out(buf_t *buf, uint16_t src_port, uint8_t *dst_ip, uint16_t dst_port)
+static void udp_out_partial(buf_t *buf, uint16_t src_port, uint8_t *dst_ip, uint16_t dst_port, uint32_t payload_sum)
 {
     buf_add_header(buf, sizeof(udp_hdr_t));
     udp_hdr_t* hdr = (udp_hdr_t*)buf->data;
 
     hdr->src_port16 = swap16(src_port);
     hdr->dst_port16 = swap16(dst_port);
-    hdr->total_len16 = swap16(buf->len);
+    hdr->total_len16 = swap16(buf_chain_len(buf));
     hdr->checksum16 = 0;
-    uint16_t checksum = udp_checksum(buf, net_if_ip, dst_ip);
+    uint16_t checksum = udp_checksum(buf, net_if_ip, dst_ip, payload_sum);
     hdr->checksum16 = checksum;
 
     ip_out(buf, dst_ip, NET_PROTOCOL_UDP);
 }
 
+/**
+ * @brief 处理一个要发送的数据包
+ * 
+ * @param buf 要处理的包，可以是scatter-gather链
+ * @param src_port 源端口号
+ * @param dst_ip 目的ip地址
+ * @param dst_port 目的端口号
+ */
+void udp_out(buf_t *buf, uint16_t src_port, uint8_t *dst_ip, uint16_t dst_port)
+{
+    udp_out_partial(buf, src_port, dst_ip, dst_port, buf_checksum16_partial(buf));
+}
+
 /**
  * @brief 初始化udp协议
  * 
@@ -107,6 +100,10 @@ void udp_out(buf_t *buf, uint16_t src_port, uint8_t *dst_ip, uint16_t dst_port)
 void udp_init()
 {
     map_init(&udp_table, sizeof(uint16_t), sizeof(udp_handler_t), 0, 0, NULL);
+    map_set_name(&udp_table, "udp_table");
+#ifdef NET_CONCURRENT_TABLES
+    map_set_concurrent(&udp_table);
+#endif
     net_add_protocol(NET_PROTOCOL_UDP, udp_in);
 }
 
@@ -143,7 +140,10 @@ void udp_close(uint16_t port)
  */
 void udp_send(uint8_t *data, uint16_t len, uint16_t src_port, uint8_t *dst_ip, uint16_t dst_port)
 {
-    buf_init(&txbuf, len);
-    memcpy(txbuf.data, data, len);
-    udp_out(&txbuf, src_port, dst_ip, dst_port);
+    buf_t *buf = buf_alloc(len);
+    if (buf == NULL) return;
+    // 拷贝时顺便计算负载的反码和，不用再读一遍
+    uint32_t payload_sum = memcpy_csum(buf->data, data, len, 0);
+    udp_out_partial(buf, src_port, dst_ip, dst_port, payload_sum);
+    buf_put(buf);
 }
\ No newline at end of file
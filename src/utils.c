@@ -1,6 +1,15 @@
 #include "utils.h"
 #include <stdio.h>
 #include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define CHECKSUM_AVX2 //编译器支持按函数启用AVX2，运行时再检测CPU
+#endif
+
+#define CHECKSUM_SIMD_MIN 64 //短于这个长度的数据直接用标量求和
 /**
  * @brief ip转字符串
  * 
@@ -69,30 +78,281 @@ uint8_t ip_prefix_match(uint8_t *ipa, uint8_t *ipb)
 }
 
 /**
- * @brief 计算16位校验和
+ * @brief 内部函数，把64位的累加和折叠为16位的反码和
+ * 
+ * @param sum 累加和
+ * @return uint32_t 16位反码和
+ */
+static inline uint32_t checksum_fold(uint64_t sum)
+{
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    return (sum & 0xffff) + (sum >> 16);
+}
+
+/**
+ * @brief 内部函数，按本机字节序以32位为单位累加到64位累加器，不需要对齐，末尾不足的字节补0
+ *        反码和与字节序无关，按本机字节序求和、存回内存即为网络字节序的结果（RFC1071）
+ * 
+ * @param p 数据
+ * @param len 长度
+ * @return uint64_t 未折叠的累加和
+ */
+static uint64_t checksum_sum_scalar(const uint8_t *p, size_t len)
+{
+    uint64_t sum0 = 0, sum1 = 0;
+    uint32_t w0, w1;
+    for (; len >= 8; p += 8, len -= 8)
+    {
+        memcpy(&w0, p, 4);
+        memcpy(&w1, p + 4, 4);
+        sum0 += w0;
+        sum1 += w1;
+    }
+    if (len >= 4)
+    {
+        memcpy(&w0, p, 4);
+        sum0 += w0;
+        p += 4;
+        len -= 4;
+    }
+    uint16_t tail = 0;
+    if (len >= 2)
+    {
+        memcpy(&tail, p, 2);
+        sum1 += tail;
+        p += 2;
+        len -= 2;
+    }
+    if (len)
+    {
+        // 奇数长度，最后一个字节放在低地址，另一半为0
+        tail = 0;
+        memcpy(&tail, p, 1);
+        sum1 += tail;
+    }
+    return sum0 + sum1;
+}
+
+#ifdef __SSE2__
+/**
+ * @brief 内部函数，SSE2版本，每次16字节，32位字零扩展后加到64位通道上
+ * 
+ * @param p 数据
+ * @param len 长度
+ * @return uint64_t 未折叠的累加和
+ */
+static uint64_t checksum_sum_sse2(const uint8_t *p, size_t len)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i acc0 = zero, acc1 = zero;
+    for (; len >= 16; p += 16, len -= 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(v, zero));
+        acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(v, zero));
+    }
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, _mm_add_epi64(acc0, acc1));
+    return lanes[0] + lanes[1] + checksum_sum_scalar(p, len);
+}
+#endif
+
+#ifdef CHECKSUM_AVX2
+/**
+ * @brief 内部函数，AVX2版本，每次32字节，运行时确认CPU支持才会使用
+ * 
+ * @param p 数据
+ * @param len 长度
+ * @return uint64_t 未折叠的累加和
+ */
+__attribute__((target("avx2"))) static uint64_t checksum_sum_avx2(const uint8_t *p, size_t len)
+{
+    __m256i zero = _mm256_setzero_si256();
+    __m256i acc0 = zero, acc1 = zero;
+    for (; len >= 32; p += 32, len -= 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)p);
+        acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v, zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v, zero));
+    }
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, _mm256_add_epi64(acc0, acc1));
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + checksum_sum_scalar(p, len);
+}
+#endif
+
+typedef uint64_t (*checksum_kernel_t)(const uint8_t *p, size_t len);
+
+static uint64_t checksum_sum_select(const uint8_t *p, size_t len);
+
+static checksum_kernel_t checksum_kernel = checksum_sum_select; //长数据使用的求和函数，第一次调用时按CPU选择
+
+/**
+ * @brief 内部函数，按CPU支持的指令集选出最快的求和函数，之后直接调用它
  * 
- * @param buf 要计算的数据包
+ * @param p 数据
+ * @param len 长度
+ * @return uint64_t 未折叠的累加和
+ */
+static uint64_t checksum_sum_select(const uint8_t *p, size_t len)
+{
+    checksum_kernel_t kernel = checksum_sum_scalar;
+#ifdef __SSE2__
+    kernel = checksum_sum_sse2;
+#endif
+#ifdef CHECKSUM_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        kernel = checksum_sum_avx2;
+#endif
+    checksum_kernel = kernel;
+    return kernel(p, len);
+}
+
+/**
+ * @brief 计算16位反码和，不取反，可以分段累加后再用checksum16_finish得到校验和
+ *        结果按内存字节序，从奇数偏移开始的一段要先swap16再累加
+ * 
+ * @param data 数据，不需要对齐
+ * @param len 长度，可以是奇数
+ * @param sum 之前的反码和，第一段为0
+ * @return uint32_t 16位反码和
+ */
+uint32_t checksum16_partial(const void *data, size_t len, uint32_t sum)
+{
+    // 协议头等短数据不值得走向量化
+    uint64_t total = len < CHECKSUM_SIMD_MIN ? checksum_sum_scalar(data, len) : checksum_kernel(data, len);
+    return checksum_fold(total + sum);
+}
+
+/**
+ * @brief 拷贝数据并同时计算16位反码和，只读一遍源数据，结果与checksum16_partial(dst, len, sum)相同
+ * 
+ * @param dst 目的地址，不能与源重叠
+ * @param src 源地址
+ * @param len 长度，可以是奇数
+ * @param sum 之前的反码和
+ * @return uint32_t 16位反码和
+ */
+uint32_t memcpy_csum(void *dst, const void *src, size_t len, uint32_t sum)
+{
+    uint8_t *d = dst;
+    const uint8_t *s = src;
+    uint64_t total = sum;
+#ifdef __SSE2__
+    __m128i zero = _mm_setzero_si128();
+    __m128i acc0 = zero, acc1 = zero;
+    for (; len >= 16; s += 16, d += 16, len -= 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)s);
+        _mm_storeu_si128((__m128i *)d, v);
+        acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(v, zero));
+        acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(v, zero));
+    }
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, _mm_add_epi64(acc0, acc1));
+    total += lanes[0] + lanes[1];
+#else
+    uint32_t w0, w1;
+    for (; len >= 8; s += 8, d += 8, len -= 8)
+    {
+        memcpy(&w0, s, 4);
+        memcpy(&w1, s + 4, 4);
+        memcpy(d, s, 8);
+        total += w0;
+        total += w1;
+    }
+#endif
+    // 剩下不足一组的部分
+    total += checksum_sum_scalar(s, len);
+    memcpy(d, s, len);
+    return checksum_fold(total);
+}
+
+/**
+ * @brief 计算udp/tcp伪头部的16位反码和，伪头部由参数给出，不需要写进数据包
+ * 
+ * @param src_ip 源ip地址
+ * @param dst_ip 目的ip地址
+ * @param protocol 上层协议号
+ * @param len udp/tcp头加负载的长度
+ * @return uint32_t 16位反码和，可以作为checksum16_partial的初值
+ */
+uint32_t checksum16_pseudo(const uint8_t *src_ip, const uint8_t *dst_ip, uint8_t protocol, uint16_t len)
+{
+    uint8_t pseudo[12];
+    memcpy(pseudo, src_ip, 4);
+    memcpy(pseudo + 4, dst_ip, 4);
+    pseudo[8] = 0;
+    pseudo[9] = protocol;
+    pseudo[10] = len >> 8;
+    pseudo[11] = len & 0xff;
+    return checksum16_partial(pseudo, sizeof(pseudo), 0);
+}
+
+/**
+ * @brief 把反码和取反得到校验和
+ * 
+ * @param sum checksum16_partial的结果
+ * @return uint16_t 校验和，可以直接写入协议头
+ */
+uint16_t checksum16_finish(uint32_t sum)
+{
+    return ~checksum_fold(sum);
+}
+
+/**
+ * @brief 计算16位校验和，原地计算，不分配内存
+ * 
+ * @param data 要计算的数据
  * @param len 要计算的长度
- * @return uint16_t 校验和
+ * @return uint16_t 校验和，可以直接写入协议头
  */
-uint16_t checksum16(uint16_t *data, size_t len)
+uint16_t checksum16(const void *data, size_t len)
 {
-    int len16 = len / sizeof(uint16_t);
-    if (len & 0x1)  len16 += 1;
+    return checksum16_finish(checksum16_partial(data, len, 0));
+}
 
-    uint16_t* checksum_data = (uint16_t*)malloc(len16*sizeof(uint16_t));
-    memset(checksum_data, 0, len16*sizeof(uint16_t));
-    memcpy(checksum_data, data, len);
+/**
+ * @brief 改写了16位字段后增量更新校验和（RFC1624，HC' = ~(~HC + ~m + m')），不需要重新遍历数据
+ *        参数都按内存字节序，即直接从协议头读出的值
+ * 
+ * @param checksum 原来的校验和
+ * @param old_field 字段原来的值
+ * @param new_field 字段新的值
+ * @return uint16_t 新的校验和
+ */
+uint16_t checksum16_update(uint16_t checksum, uint16_t old_field, uint16_t new_field)
+{
+    uint32_t sum = (uint16_t)~checksum + (uint16_t)~old_field + new_field;
+    return checksum16_finish(sum);
+}
 
-    uint32_t sum = 0;
-    for (int i = 0; i < len16; i++)
+/**
+ * @brief 改写了一段字段（如ip地址、端口）后增量更新校验和
+ * 
+ * @param checksum 原来的校验和
+ * @param old_data 字段原来的内容
+ * @param new_data 字段新的内容
+ * @param len 字段长度，偶数，且字段在校验范围内的偏移也是偶数
+ * @return uint16_t 新的校验和
+ */
+uint16_t checksum16_update_bytes(uint16_t checksum, const void *old_data, const void *new_data, size_t len)
+{
+    const uint8_t *old_p = old_data, *new_p = new_data;
+    uint32_t sum = (uint16_t)~checksum;
+    for (size_t i = 0; i + 1 < len; i += 2)
     {
-        sum += swap16(checksum_data[i]);
-        while (sum >> 16)
-        {
+        uint16_t old_field, new_field;
+        memcpy(&old_field, old_p + i, 2);
+        memcpy(&new_field, new_p + i, 2);
+        sum += (uint16_t)~old_field + new_field;
+        // 字段很长时提前折叠，避免溢出
+        if (sum >> 31)
             sum = (sum & 0xffff) + (sum >> 16);
-        }
     }
-    free(checksum_data);
-    return swap16(~sum);
-}
\ No newline at end of file
+    return checksum16_finish(sum);
+}
@@ -0,0 +1,98 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define BENCH_RDTSC //有时间戳计数器，可以直接统计周期数
+#endif
+
+#ifndef BENCH_MIN_NS
+#define BENCH_MIN_NS 200000000ull //每项至少运行的时间，不够就把迭代次数翻倍重跑
+#endif
+
+/**
+ * @brief 被测的一批操作，iters为要执行的次数
+ *
+ */
+typedef void (*bench_fn_t)(void *arg, size_t iters);
+
+/**
+ * @brief 防止编译器把没用到结果的被测代码优化掉
+ *
+ */
+static volatile uint64_t bench_sink;
+
+static uint64_t bench_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint64_t bench_cycles()
+{
+#ifdef BENCH_RDTSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+/**
+ * @brief 输出CSV表头，每个结果一行，方便脚本比较前后两次的数字
+ *        arg的含义由各项测试自己定义（如对齐偏移、头部长度、装载率）
+ *
+ */
+static void bench_header()
+{
+    printf("bench,op,size,arg,iters,ns_per_op,cycles_per_op,bytes_per_cycle\n");
+    fflush(stdout);
+}
+
+/**
+ * @brief 运行一项测试并输出一行结果
+ *        先预热一次，再把迭代次数翻倍直到总时间超过BENCH_MIN_NS
+ *
+ * @param bench 测试程序名
+ * @param op 操作名
+ * @param size 每次操作处理的字节数或表的容量
+ * @param arg 操作相关的参数
+ * @param bytes 每次操作处理的字节数，不按字节计的操作为0，此时不输出bytes_per_cycle
+ * @param fn 被测函数
+ * @param fn_arg 被测函数的参数
+ */
+static void bench_run(const char *bench, const char *op, size_t size, size_t arg, size_t bytes, bench_fn_t fn, void *fn_arg)
+{
+    size_t iters = 1;
+    uint64_t ns, cycles;
+    fn(fn_arg, 16);
+    for (;;)
+    {
+        uint64_t t0 = bench_now_ns();
+        uint64_t c0 = bench_cycles();
+        fn(fn_arg, iters);
+        cycles = bench_cycles() - c0;
+        ns = bench_now_ns() - t0;
+        if (ns >= BENCH_MIN_NS || iters >= ((size_t)1 << 40))
+            break;
+        iters *= 2;
+    }
+
+    double cycles_per_op = (double)cycles / iters;
+    printf("%s,%s,%zu,%zu,%zu,%.3f,", bench, op, size, arg, iters, (double)ns / iters);
+    if (cycles)
+        printf("%.2f,", cycles_per_op);
+    else
+        printf(",");
+    if (cycles && bytes)
+        printf("%.3f\n", bytes / cycles_per_op);
+    else
+        printf("\n");
+    fflush(stdout);
+}
+
+#endif
@@ -0,0 +1,73 @@
+#include <string.h>
+#include "bench.h"
+#include "buf.h"
+
+static const size_t sizes[] = {64, 576, 1514, 9000, UINT16_MAX};
+
+#define BENCH_HEADER_LEN 14 //以太网头的长度，buf_add_header每次加的长度
+
+typedef struct buf_arg
+{
+    buf_t *src;
+    buf_t *dst;
+    size_t len;
+} buf_arg_t;
+
+static void run_init(void *p, size_t iters)
+{
+    buf_arg_t *arg = p;
+    for (size_t i = 0; i < iters; i++)
+        buf_init(arg->dst, arg->len);
+    bench_sink = arg->dst->len;
+}
+
+static void run_add_header(void *p, size_t iters)
+{
+    buf_arg_t *arg = p;
+    for (size_t i = 0; i < iters; i++)
+    {
+        buf_add_header(arg->src, BENCH_HEADER_LEN);
+        buf_remove_header(arg->src, BENCH_HEADER_LEN);
+    }
+    bench_sink = arg->src->len;
+}
+
+static void run_copy(void *p, size_t iters)
+{
+    buf_arg_t *arg = p;
+    for (size_t i = 0; i < iters; i++)
+        buf_copy(arg->dst, arg->src, 0);
+    bench_sink = arg->dst->len;
+}
+
+static void run_alloc(void *p, size_t iters)
+{
+    buf_arg_t *arg = p;
+    size_t len = 0;
+    for (size_t i = 0; i < iters; i++)
+    {
+        buf_t *buf = buf_alloc(arg->len);
+        len += buf->len;
+        buf_put(buf);
+    }
+    bench_sink = len;
+}
+
+int main(int argc, char *argv[])
+{
+    static buf_t src, dst;
+
+    bench_header();
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        size_t len = sizes[i];
+        buf_init(&src, len);
+        memset(src.data, 0x5a, len);
+        buf_arg_t arg = {&src, &dst, len};
+        bench_run("bench_buf", "buf_init", len, 0, 0, run_init, &arg);
+        bench_run("bench_buf", "buf_add_header", len, BENCH_HEADER_LEN, 0, run_add_header, &arg);
+        bench_run("bench_buf", "buf_copy", len, 0, len, run_copy, &arg);
+        bench_run("bench_buf", "buf_alloc", len, 0, 0, run_alloc, &arg);
+    }
+    return 0;
+}
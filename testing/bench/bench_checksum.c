@@ -0,0 +1,64 @@
+#include <string.h>
+#include "bench.h"
+#include "utils.h"
+
+static const size_t sizes[] = {20, 64, 576, 1500, 9000, 65535};
+
+typedef struct checksum_arg
+{
+    const uint8_t *src; // 被求和的数据
+    uint8_t *dst;       // memcpy_csum的目的地址
+    size_t len;
+} checksum_arg_t;
+
+static void run_checksum16(void *p, size_t iters)
+{
+    checksum_arg_t *arg = p;
+    uint64_t sum = 0;
+    for (size_t i = 0; i < iters; i++)
+        sum += checksum16(arg->src, arg->len);
+    bench_sink = sum;
+}
+
+static void run_memcpy_csum(void *p, size_t iters)
+{
+    checksum_arg_t *arg = p;
+    uint64_t sum = 0;
+    for (size_t i = 0; i < iters; i++)
+        sum += memcpy_csum(arg->dst, arg->src, arg->len, 0);
+    bench_sink = sum;
+}
+
+static void run_memcpy(void *p, size_t iters)
+{
+    checksum_arg_t *arg = p;
+    for (size_t i = 0; i < iters; i++)
+    {
+        memcpy(arg->dst, arg->src, arg->len);
+        __asm__ __volatile__("" ::: "memory");
+    }
+    bench_sink = arg->dst[0];
+}
+
+int main(int argc, char *argv[])
+{
+    // 多留一个字节用来测奇地址
+    static uint8_t src[65536 + 64], dst[65536 + 64];
+    for (size_t i = 0; i < sizeof(src); i++)
+        src[i] = (uint8_t)(i * 131 + 7);
+
+    bench_header();
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        size_t len = sizes[i];
+        for (size_t offset = 0; offset <= 1; offset++)
+        {
+            checksum_arg_t arg = {src + offset, dst, len};
+            bench_run("bench_checksum", "checksum16", len, offset, len, run_checksum16, &arg);
+        }
+        checksum_arg_t arg = {src, dst, len};
+        bench_run("bench_checksum", "memcpy_csum", len, 0, len, run_memcpy_csum, &arg);
+        bench_run("bench_checksum", "memcpy", len, 0, len, run_memcpy, &arg);
+    }
+    return 0;
+}
@@ -0,0 +1,104 @@
+#include <string.h>
+#include "bench.h"
+#include "map.h"
+#include "net.h"
+
+static const size_t capacities[] = {64, 1024, 16384, 262144};
+static const size_t loads[] = {25, 50, 90}; //装载率，百分比
+
+typedef struct map_arg
+{
+    map_t *map;
+    const uint32_t *keys; // 表中已有的key
+    size_t n;             // keys的个数
+    uint32_t miss_base;   // 从这个值开始的key都不在表中
+} map_arg_t;
+
+/**
+ * @brief 不链接net.c，时间固定为0，表项不会超时
+ *
+ * @return uint64_t
+ */
+uint64_t net_now()
+{
+    return 0;
+}
+
+/**
+ * @brief 把序号打散成key，避免连续的key落在连续的槽里
+ *
+ */
+static uint32_t bench_key(uint32_t i)
+{
+    return i * 2654435761u;
+}
+
+static void run_get_hit(void *p, size_t iters)
+{
+    map_arg_t *arg = p;
+    uint64_t found = 0;
+    for (size_t i = 0, j = 0; i < iters; i++)
+    {
+        found += map_get(arg->map, &arg->keys[j]) != NULL;
+        if (++j == arg->n)
+            j = 0;
+    }
+    bench_sink = found;
+}
+
+static void run_get_miss(void *p, size_t iters)
+{
+    map_arg_t *arg = p;
+    uint64_t found = 0;
+    for (size_t i = 0; i < iters; i++)
+    {
+        uint32_t key = bench_key(arg->miss_base + (uint32_t)(i & 0xffff));
+        found += map_get(arg->map, &key) != NULL;
+    }
+    bench_sink = found;
+}
+
+static void run_set(void *p, size_t iters)
+{
+    map_arg_t *arg = p;
+    uint64_t value = 0;
+    for (size_t i = 0, j = 0; i < iters; i++)
+    {
+        value++;
+        map_set(arg->map, &arg->keys[j], &value);
+        if (++j == arg->n)
+            j = 0;
+    }
+    bench_sink = value;
+}
+
+int main(int argc, char *argv[])
+{
+    bench_header();
+    for (size_t i = 0; i < sizeof(capacities) / sizeof(capacities[0]); i++)
+    {
+        for (size_t k = 0; k < sizeof(loads) / sizeof(loads[0]); k++)
+        {
+            size_t cap = capacities[i];
+            size_t n = cap * loads[k] / 100;
+            uint32_t *keys = malloc(n * sizeof(uint32_t));
+            map_t map;
+            map_init(&map, sizeof(uint32_t), sizeof(uint64_t), cap, 0, NULL);
+            for (size_t j = 0; j < n; j++)
+            {
+                uint64_t value = j;
+                keys[j] = bench_key((uint32_t)j);
+                map_set(&map, &keys[j], &value);
+            }
+
+            map_arg_t arg = {&map, keys, n, (uint32_t)cap};
+            bench_run("bench_map", "map_get_hit", cap, loads[k], 0, run_get_hit, &arg);
+            bench_run("bench_map", "map_get_miss", cap, loads[k], 0, run_get_miss, &arg);
+            bench_run("bench_map", "map_set", cap, loads[k], 0, run_set, &arg);
+
+            map_destroy(&map);
+            free(keys);
+        }
+    }
+    return 0;
+}
@@ -1,4 +1,5 @@
 #include "net.h"
+#include "queue.h"
 #include <string.h>
 #include <stdio.h>
 
@@ -38,7 +39,8 @@ void arp_out(buf_t *buf, uint8_t *ip)
 
 void arp_init()
 {
-    map_init(&arp_table, NET_IP_LEN, NET_MAC_LEN, 0, ARP_TIMEOUT_SEC, NULL);
-    map_init(&arp_buf, NET_IP_LEN, sizeof(buf_t), 0, ARP_MIN_INTERVAL, buf_copy);
+    map_init(&arp_table, NET_IP_LEN, NET_MAC_LEN, ARP_MAX_ENTRY, ARP_TIMEOUT_SEC * 1000, NULL);
+    map_set_evict(&arp_table, MAP_EVICT_CLOCK);
+    map_init(&arp_buf, NET_IP_LEN, sizeof(queue_t*), 0, ARP_MIN_INTERVAL * 1000, NULL);
     net_add_protocol(NET_PROTOCOL_ARP, arp_in);
 }
\ No newline at end of file
@@ -68,9 +68,14 @@ int driver_recv(buf_t *buf)
                 // printf("meet end of file\n");
                 return 0;
         }else if (ret == 1){
-                buf_init(buf,pkt_hdr->len);
-                memcpy(buf->data, pkt_data, pkt_hdr->len);
-                return pkt_hdr->len;
+#ifdef DRIVER_ZERO_COPY
+                if (buf_wrap(buf, (uint8_t *)pkt_data, pkt_hdr->caplen) != 0)
+                        return -1;
+#else
+                buf_init(buf,pkt_hdr->caplen);
+                memcpy(buf->data, pkt_data, pkt_hdr->caplen);
+#endif
+                return pkt_hdr->caplen;
         }else{
                 fprintf(stderr, "Error in driver_recv: %s\n", pcap_geterr(pcap));
                 return -1;
@@ -79,11 +84,13 @@ int driver_recv(buf_t *buf)
 
 int driver_send(buf_t *buf)
 {
+        static uint8_t frame[BUF_MAX_LEN];
         struct pcap_pkthdr header;
+        size_t len = buf_gather(buf, frame, sizeof(frame));
         memset(&header.ts,0,sizeof(header.ts));
-        header.caplen = buf->len;
-        header.len = buf->len;
-        pcap_dump((u_char *)pdump,&header,buf->data);
+        header.caplen = len;
+        header.len = len;
+        pcap_dump((u_char *)pdump,&header,frame);
         return 0;
 }
 
@@ -21,9 +21,9 @@ int main(int argc, char* argv[])
                 return -1;
         }
         arp_fout = control_flow;
-        uint8_t * p = buf.payload + 1000;
-        buf.data = p;
-        buf.len = 0;
+        buf_init(&buf, 0);
+        buf_reserve(&buf, UINT16_MAX);
+        uint8_t * p = buf.data;
         char c;
         while(fread(&c,1,1,in)){
                 *p = c;
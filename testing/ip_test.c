@@ -55,17 +55,17 @@ int main(int argc, char* argv[]){
                 // printf("\nFeeding input %02d\n",i);
                 fprintf(control_flow,"\nRound %02d -----------------------------\n",i++);
                 if(memcmp(buf.data,my_mac,6) && memcmp(buf.data,boardcast_mac,6)){
-                        buf_t buf2;
-                        buf_copy(&buf2, &buf, 0);
-                        memset(buf2.data,0,sizeof(ether_hdr_t));
-                        buf_remove_header(&buf2, sizeof(ether_hdr_t));
-                        int len = (buf2.data[0] & 0xf) << 2;
+                        buf_t *buf2 = buf_get(&buf);
+                        memset(buf2->data,0,sizeof(ether_hdr_t));
+                        buf_remove_header(buf2, sizeof(ether_hdr_t));
+                        int len = (buf2->data[0] & 0xf) << 2;
                         uint8_t * ip = buf.data + 30;
-                        net_protocol_t pro = buf2.data[9];
-                        memset(buf2.data,0,len);
-                        buf_remove_header(&buf2, len);
+                        net_protocol_t pro = buf2->data[9];
+                        memset(buf2->data,0,len);
+                        buf_remove_header(buf2, len);
                         // printf("ip_out: hd_len:%d\tip:%s\tpro:%d\n",len,print_ip(ip),pro);
-                        ip_out(&buf2,ip,pro);
+                        ip_out(buf2,ip,pro);
+                        buf_put(buf2);
                 }else{
                         ethernet_in(&buf);
                 }
@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <string.h>
+#include "trace.h"
+
+static const char *layer_name[] = {
+    [TRACE_DRIVER] = "driver",
+    [TRACE_ETHERNET] = "eth",
+    [TRACE_ARP] = "arp",
+    [TRACE_IP] = "ip",
+    [TRACE_TCP] = "tcp",
+};
+
+static const char *event_name[] = {
+    [TRACE_IN] = "in",
+    [TRACE_OUT] = "out",
+    [TRACE_STATE] = "state",
+};
+
+static const char *verdict_name[] = {
+    [TRACE_PASS] = "pass",
+    [TRACE_DROP] = "drop",
+    [TRACE_QUEUED] = "queued",
+    [TRACE_REJECT] = "reject",
+};
+
+// 与tcp_state_t的顺序一致
+static const char *tcp_state_name[] = {
+    "LISTEN", "SYN_SEND", "SYN_RCVD", "ESTABLISHED", "CLOSE_WAIT",
+    "LAST_ACK", "FIN_WAIT_1", "FIN_WAIT_2", "CLOSING", "TIME_WAIT",
+};
+
+#define NAME(table, i) ((i) < sizeof(table) / sizeof(table[0]) && table[i] ? table[i] : "?")
+
+/**
+ * @brief 输出一条记录，一行，字段之间用空格分隔
+ *
+ * @param record 要输出的记录
+ */
+static void print_record(const trace_record_t *record)
+{
+    printf("%10u %llu.%03u %-6s %-5s ", record->seq, (unsigned long long)record->time / 1000,
+           (unsigned)(record->time % 1000), NAME(layer_name, record->layer), NAME(event_name, record->event));
+    if (record->event == TRACE_STATE)
+        printf("%-11s ", NAME(tcp_state_name, record->verdict));
+    else
+        printf("%-11s ", NAME(verdict_name, record->verdict));
+    printf("proto 0x%04x ", record->protocol);
+    if (record->layer == TRACE_IP || record->layer == TRACE_ARP || record->layer == TRACE_TCP)
+        printf("%u.%u.%u.%u:%u -> %u.%u.%u.%u:%u ",
+               record->src_ip[0], record->src_ip[1], record->src_ip[2], record->src_ip[3], record->src_port,
+               record->dst_ip[0], record->dst_ip[1], record->dst_ip[2], record->dst_ip[3], record->dst_port);
+    printf("len %u\n", record->len);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 2)
+    {
+        fprintf(stderr, "usage: %s <trace file>\n", argv[0]);
+        return 1;
+    }
+    FILE *file = fopen(argv[1], "rb");
+    if (file == NULL)
+    {
+        fprintf(stderr, "can not open %s\n", argv[1]);
+        return 1;
+    }
+
+    trace_file_hdr_t hdr;
+    if (fread(&hdr, sizeof(hdr), 1, file) != 1 || memcmp(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic)))
+    {
+        fprintf(stderr, "%s is not a trace file\n", argv[1]);
+        fclose(file);
+        return 1;
+    }
+    if (hdr.version != TRACE_VERSION || hdr.record_size != sizeof(trace_record_t))
+    {
+        fprintf(stderr, "unsupported trace version %u (record size %u)\n", hdr.version, hdr.record_size);
+        fclose(file);
+        return 1;
+    }
+
+    printf("# %u records, %llu older records overwritten\n", hdr.count, (unsigned long long)hdr.lost);
+    trace_record_t record;
+    uint32_t n = 0;
+    while (n < hdr.count && fread(&record, sizeof(record), 1, file) == 1)
+    {
+        print_record(&record);
+        n++;
+    }
+    fclose(file);
+    if (n != hdr.count)
+    {
+        fprintf(stderr, "truncated trace file: %u of %u records\n", n, hdr.count);
+        return 1;
+    }
+    return 0;
+}